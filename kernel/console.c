@@ -84,7 +84,7 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
+  int c, c2;
   char cbuf;
 
   target = n;
@@ -111,9 +111,13 @@ consoleread(int user_dst, uint64 dst, int n)
       break;
     }
 
-    // copy the input byte to the user-space buffer.
+    // copy the input byte to the user-space buffer, without
+    // cons.lock, since the copy may read the page in from swap.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    release(&cons.lock);
+    c2 = either_copyout(user_dst, dst, &cbuf, 1);
+    acquire(&cons.lock);
+    if(c2 == -1)
       break;
 
     dst++;
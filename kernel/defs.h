@@ -2,6 +2,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct mmap_area;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -23,7 +24,8 @@ void            consoleintr(int);
 void            consputc(int);
 
 // exec.c
-int             kexec(char*, char**);
+int             kexec(struct proc*, char*, char**);
+int             execfault(struct proc*, uint64, int);
 
 // file.c
 struct file*    filealloc(void);
@@ -54,9 +56,28 @@ void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
 void            ireclaim(int);
+char*           pcget(struct inode*, uint);
+void            pcdrop(struct inode*);
+void            pcmarkdirty(struct inode*, uint);
+void            pcflush(struct inode*);
+void            pcflushd(void);
+char*           pclookup(struct inode*, uint);
+void            pcreadahead(struct inode*, uint, uint);
+void            pcreadd(void);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
+int             kzero_idle(void);
+void            krefinc(void *);
+int             krefcnt(void *);
+void*           khugealloc(void);
+void            khugefree(void *);
+void            khugesplit(void *);
+int             khugecount(void);
+void            ksetlazy(void *, int);
+int             kislazy(void *);
+int             kfreepages(void);
 void            kfree(void *);
 void            kinit(void);
 uint64		countfree(void);
@@ -82,6 +103,7 @@ void            printfinit(void);
 int             cpuid(void);
 void            kexit(int);
 int             kfork(void);
+int             kspawn(char*, char**, int*, int);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -106,9 +128,24 @@ int		getnice(int);
 int		setnice(int pid, int value);
 void		ps(int);
 int		meminfo(void);
+int		memstat(int, uint64);
+int		setrlimit(int, uint64);
 int		waitpid(int);
 uint64		mmap(uint64 addr, int length, int prot, int flags, int fd, int offset);
-int		munmap(uint64 addr);
+int		munmap(uint64 addr, int length);
+int		mprotect(uint64 addr, int length, int prot);
+void		tlbshootdown(struct proc*);
+uint64		procsatp(struct proc*);
+int		madvise(uint64 addr, int length, int advice);
+uint64		mremap(uint64 addr, int oldlen, int newlen, int flags);
+void		lazyreclaim(struct proc*);
+void		mmap_unmapall(struct proc*, pagetable_t);
+void		mmap_stack(struct proc*);
+int		mmap_heapfits(struct proc*, uint64);
+void		mmap_collectall(struct proc*);
+struct mmap_area* mmap_lookup(struct proc*, uint64);
+int		msync(uint64, int);
+void		kthread(char*, void (*)(void));
 int 		freemem();
 
 // swtch.S
@@ -117,6 +154,7 @@ void            swtch(struct context*, struct context*);
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             holdinglocks(void);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
@@ -136,6 +174,7 @@ char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
+void            membench(void);
 
 // syscall.c
 void            argint(int, int*);
@@ -166,18 +205,33 @@ void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
+int             uvmmega(pagetable_t, uint64, int);
+int             uvmsplitmega(pagetable_t, uint64);
+void            uvmprotect(pagetable_t, uint64, uint64, int, int);
+int             uvmmove(pagetable_t, uint64, uint64, uint64);
+int             uvmlazyfree(pagetable_t, uint64, uint64);
+int             uvmreclaim(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
-void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walkrange(pagetable_t, uint64, uint64 *);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             userfault(pagetable_t, uint64, int);
+void            uprefault(pagetable_t, uint64, uint64, int);
 int             ismapped(pagetable_t, uint64);
 uint64          vmfault(pagetable_t, uint64, int);
+int             handle_mmap_pgfault(struct proc*, uint64, int);
+int             cowfault(pagetable_t, uint64);
+void            vmaccount(pagetable_t, uint64, int, int);
+void            vmrecount(struct proc *);
+void            uvmshare(pte_t *, char *);
+char*           mmap_filepage(struct mmap_area*, uint64);
 
 // plic.c
 void            plicinit(void);
@@ -188,9 +242,40 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwpages(uint64, char **, int, int);
 void            virtio_disk_intr(void);
 
+// swap.c
+void            swapinit(void);
+void            swapdup(int);
+void            swapfree(int);
+void            swapio(int, char **, int, int);
+int             swapcount(int);
+int             swapin(pagetable_t, uint64, int);
+void            kswapd(void);
+int             swapwait(void);
+
+// zswap.c
+void            zswapinit(void);
+int             zswap_store(int, char *);
+int             zswap_load(int, char *);
+void            zswap_drop(int);
+void            zswapinfo(void);
+
+// ksm.c
+void            ksminit(void);
+void            ksmd(void);
+void            ksminfo(void);
+
+// oom.c
+void            oominit(void);
+int             oom(void);
+int             oomadj(int, int);
+
+// lz.c
+int             lz_compress(const uchar *, int, uchar *, int, ushort *);
+int             lz_decompress(const uchar *, int, uchar *, int);
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
 
-extern struct mmap_manager mmap_manager;
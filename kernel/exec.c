@@ -4,6 +4,9 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "defs.h"
 #include "elf.h"
 
@@ -21,19 +24,23 @@ int flags2perm(int flags)
 }
 
 //
-// the implementation of the exec() system call
+// the implementation of the exec() system call:
+// replace p's user image with the program at path.
+// p is the caller, or a new process that kspawn()
+// is setting up.
 //
 int
-kexec(char *path, char **argv)
+kexec(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
+  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase = 0;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct execseg segs[NEXECSEG];
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 
   begin_op();
 
@@ -55,7 +62,9 @@ kexec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Load program into memory. Segments whose file offset is
+  // page-aligned, as the linker lays them out, are paged in on
+  // demand by execfault(); others are read now.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -67,6 +76,19 @@ kexec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.vaddr < sz || ph.vaddr + ph.memsz > MMAPBASE)
+      goto bad;
+    if(ph.off % PGSIZE == 0 && ph.off + ph.filesz >= ph.off &&
+       ph.off + ph.filesz <= MAXFILE*BSIZE && nseg < NEXECSEG){
+      segs[nseg].va = ph.vaddr;
+      segs[nseg].filesz = ph.filesz;
+      segs[nseg].memsz = ph.memsz;
+      segs[nseg].off = ph.off;
+      segs[nseg].perm = flags2perm(ph.flags);
+      nseg++;
+      sz = ph.vaddr + ph.memsz;
+      continue;
+    }
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
@@ -74,23 +96,21 @@ kexec(char *path, char **argv)
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
+  if(nseg > 0)
+    exe = idup(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
-  // Allocate some pages at the next page boundary.
-  // Make the first inaccessible as a stack guard.
-  // Use the rest as the user stack.
+  // The heap starts at the next page boundary. The stack
+  // grows down from USTACKTOP on demand (see mmap_stack());
+  // allocate its top pages now, for the arguments.
   sz = PGROUNDUP(sz);
-  uint64 sz1;
-  if((sz1 = uvmalloc(pagetable, sz, sz + (USERSTACK+1)*PGSIZE, PTE_W)) == 0)
+  if(uvmalloc(pagetable, USTACKTOP - USERSTACK*PGSIZE, USTACKTOP, PTE_W) == 0)
     goto bad;
-  sz = sz1;
-  uvmclear(pagetable, sz-(USERSTACK+1)*PGSIZE);
-  sp = sz;
+  sp = USTACKTOP;
   stackbase = sp - USERSTACK*PGSIZE;
 
   // Copy argument strings into new stack, remember their
@@ -128,22 +148,42 @@ kexec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  oldexe = p->exe;
+  p->exe = exe;
+  memmove(p->segs, segs, sizeof(segs));
+  p->nseg = nseg;
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  p->asid = 0;    // a new ASID for the new page table
   p->sz = sz;
+  vmrecount(p);
   p->trapframe->epc = elf.entry;  // initial program counter = ulib.c:start()
   p->trapframe->sp = sp; // initial stack pointer
+  mmap_unmapall(p, oldpagetable);
+  mmap_stack(p);
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
+  if(stackbase)
+    uvmunmap(pagetable, stackbase, USERSTACK, 1);
   if(pagetable)
     proc_freepagetable(pagetable, sz);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
@@ -171,3 +211,116 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
   
   return 0;
 }
+
+// Can page off of segment s map the cached file page itself?
+// Only if the page holds nothing but file data, or the segment
+// has no zero-filled part after it.
+static int
+execwhole(struct execseg *s, uint64 off)
+{
+  return off < s->filesz && (off + PGSIZE <= s->filesz || s->filesz == s->memsz);
+}
+
+// Map cached file page pg at va, copy-on-write if perm is
+// writable. Drops the reference to pg that the caller took
+// for the mapping if that fails.
+static int
+execmap(pagetable_t pagetable, uint64 va, char *pg, int perm)
+{
+  if(perm & PTE_W)
+    perm = (perm & ~PTE_W) | PTE_COW;
+  if(mappages(pagetable, va, PGSIZE, (uint64)pg, perm) != 0){
+    kfree(pg);
+    return -1;
+  }
+  return 0;
+}
+
+// Page in user address va of p's executable. A page of file
+// data maps the page cache's copy, which every process running
+// the program shares, copy-on-write in a writable segment; the
+// other pages of its FAULTAROUND-page block that are cached are
+// mapped too. The page where the file data of a segment ends
+// gets a private copy with the rest zeroed, and the pages after
+// it are zero-filled.
+// Returns 1 if va is now mapped for the access, 0 if it is not
+// in a segment left to be paged in, or -1 if the access is not
+// allowed or out of memory.
+int
+execfault(struct proc *p, uint64 va, int write)
+{
+  struct inode *ip = p->exe;
+  struct execseg *s;
+  uint64 off, a, lo, hi, n;
+  char *pg, *mem = 0;
+  int perm, locked, r = -1;
+
+  // sbrk() may have shrunk p below the segment.
+  if(va >= p->sz)
+    return 0;
+  va = PGROUNDDOWN(va);
+  for(s = p->segs; s < &p->segs[p->nseg]; s++)
+    if(va >= s->va && va < s->va + s->memsz)
+      break;
+  if(s == &p->segs[p->nseg])
+    return 0;
+  if(ismapped(p->pagetable, va) || (write && (s->perm & PTE_W) == 0))
+    return -1;
+  perm = PTE_U | PTE_R | s->perm;
+  off = va - s->va;
+
+  if(off >= s->filesz){
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+      kfree(mem);
+      return -1;
+    }
+    return 1;
+  }
+  if(!execwhole(s, off) && (mem = kalloc()) == 0)
+    return -1;
+
+  // the caller may hold ip's lock already: readi() copying
+  // the executable into a page of its own not yet touched.
+  // Callers holding another inode's lock must have paged the
+  // range in with uprefault() instead.
+  if((locked = holdingsleep(&ip->lock)) == 0)
+    ilock(ip);
+  if((pg = pcget(ip, (s->off + off) / PGSIZE)) == 0)
+    goto out;
+  if(mem){
+    n = s->filesz - off;
+    memmove(mem, pg, n);
+    memset(mem + n, 0, PGSIZE - n);
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0)
+      goto out;
+    mem = 0;
+  } else {
+    krefinc(pg);
+    if(execmap(p->pagetable, va, pg, perm) < 0)
+      goto out;
+    lo = off - off % (FAULTAROUND*PGSIZE);
+    hi = lo + FAULTAROUND*PGSIZE;
+    for(a = lo; a < hi && p->rss < p->rsslimit; a += PGSIZE){
+      if(a == off || !execwhole(s, a) || ismapped(p->pagetable, s->va + a))
+        continue;
+      if((pg = pclookup(ip, (s->off + a) / PGSIZE)) == 0)
+        continue;
+      krefinc(pg);
+      if(execmap(p->pagetable, s->va + a, pg, perm) < 0)
+        break;
+    }
+    // a write breaks the sharing at once.
+    if(write && cowfault(p->pagetable, va) < 0)
+      goto out;
+  }
+  r = 1;
+
+ out:
+  if(!locked)
+    iunlock(ip);
+  if(mem)
+    kfree(mem);
+  return r;
+}
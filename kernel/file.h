@@ -27,8 +27,13 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+  uint64 *pcache;     // page cache: file page number -> page | PC_DIRTY
+  int ndirty;         // number of PC_DIRTY pages in pcache
 };
 
+#define PC_DIRTY 1    // page cache entry has unwritten changes
+#define PCPAGE(e) ((char*)((e) & ~(uint64)PC_DIRTY))
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
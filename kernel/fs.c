@@ -22,6 +22,7 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define PCSLOTS (PGSIZE / sizeof(uint64)) // entries in ip->pcache
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -179,12 +180,27 @@ struct {
   struct inode inode[NINODE];
 } itable;
 
+// Readahead requests, queued by file mmap faults for the
+// pcreadd daemon. r and w count requests taken and added.
+struct {
+  struct spinlock lock;
+  struct {
+    struct inode *ip;
+    uint pgno;
+    uint n;
+  } req[NREADAHEAD];
+  uint r, w;
+} raq;
+
 void
 iinit()
 {
   int i = 0;
   
+  if(MAXFILE*BSIZE > PCSLOTS*PGSIZE)
+    panic("iinit: page cache too small");
   initlock(&itable.lock, "itable");
+  initlock(&raq.lock, "readahead");
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
   }
@@ -339,6 +355,11 @@ iput(struct inode *ip)
 {
   acquire(&itable.lock);
 
+  if(ip->ref == 1){
+    // nobody else can be using the page cache.
+    pcdrop(ip);
+  }
+
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
 
@@ -473,6 +494,252 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcdrop(ip);
+}
+
+// Page cache
+//
+// Each in-memory inode can cache whole pages of its file
+// contents in ip->pcache, a page of 512 physical page
+// addresses indexed by file page number. That is enough
+// for MAXFILE, so the radix tree has a single level.
+// readi() reads through the cache, writei() updates pages
+// that are already cached, and file-backed mmap maps the
+// cached pages themselves, so processes mapping the same
+// file share one copy. The cache holds one reference on
+// each page (see kfree) and is dropped by itrunc() and by
+// the last iput().
+// Pages written through MAP_SHARED mappings are tagged
+// PC_DIRTY in their entry and written back by pcflush(),
+// from msync, munmap, exit and the pcflushd daemon.
+// Read file page pgno of ip into pg, zeroing whatever lies
+// beyond the end of the file.
+static void
+pcfill(struct inode *ip, uint pgno, char *pg)
+{
+  uint off, n, m, addr;
+  struct buf *bp;
+
+  off = pgno * PGSIZE;
+  n = 0;
+  if(off < ip->size)
+    n = min(ip->size - off, PGSIZE);
+
+  for(m = 0; m < n; m += BSIZE){
+    if((addr = bmap(ip, (off + m) / BSIZE)) == 0)
+      break;
+    bp = bread(ip->dev, addr);
+    memmove(pg + m, bp->data, min(n - m, BSIZE));
+    brelse(bp);
+  }
+  if(m > n)
+    m = n;
+  memset(pg + m, 0, PGSIZE - m);
+}
+
+// Return the cached page holding file page pgno of ip,
+// reading it from disk on first use.
+// Returns 0 if out of memory.
+// Caller must hold ip->lock.
+char*
+pcget(struct inode *ip, uint pgno)
+{
+  char *pg;
+
+  if(pgno >= PCSLOTS)
+    return 0;
+  if(ip->pcache == 0 && (ip->pcache = kalloc_zeroed()) == 0)
+    return 0;
+  if((pg = PCPAGE(ip->pcache[pgno])) != 0)
+    return pg;
+  if((pg = kalloc()) == 0)
+    return 0;
+  pcfill(ip, pgno, pg);
+  ip->pcache[pgno] = (uint64)pg;
+  return pg;
+}
+
+// Return the cached page holding file page pgno of ip,
+// or 0 if it is not cached. Never reads the disk.
+// Caller must hold ip->lock.
+char*
+pclookup(struct inode *ip, uint pgno)
+{
+  if(ip->pcache == 0 || pgno >= PCSLOTS)
+    return 0;
+  return PCPAGE(ip->pcache[pgno]);
+}
+
+// Ask pcreadd to bring file pages [pgno, pgno+n) of ip into
+// the page cache, without waiting for the disk. The request
+// is dropped if the queue is full.
+void
+pcreadahead(struct inode *ip, uint pgno, uint n)
+{
+  acquire(&raq.lock);
+  if(raq.w - raq.r < NREADAHEAD){
+    int i = raq.w++ % NREADAHEAD;
+    raq.req[i].ip = idup(ip);
+    raq.req[i].pgno = pgno;
+    raq.req[i].n = n;
+    wakeup(&raq.r);
+  }
+  release(&raq.lock);
+}
+
+// Readahead daemon: fill the page cache for queued requests,
+// one page per ilock() so faulting processes are not held up
+// behind a whole window. Runs as a kernel process started by main().
+void
+pcreadd(void)
+{
+  struct inode *ip;
+  uint pgno, n;
+
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  for(;;){
+    acquire(&raq.lock);
+    while(raq.r == raq.w)
+      sleep(&raq.r, &raq.lock);
+    int i = raq.r++ % NREADAHEAD;
+    ip = raq.req[i].ip;
+    pgno = raq.req[i].pgno;
+    n = raq.req[i].n;
+    release(&raq.lock);
+
+    for(; n > 0; n--, pgno++){
+      ilock(ip);
+      int stop = pgno*PGSIZE >= ip->size || pcget(ip, pgno) == 0;
+      iunlock(ip);
+      if(stop)
+        break;
+    }
+    begin_op();
+    iput(ip);
+    end_op();
+  }
+}
+
+// Drop the page cache of ip. Pages that are still mapped
+// by some process stay allocated until it unmaps them.
+// Caller must hold ip->lock, or the only reference to ip.
+void
+pcdrop(struct inode *ip)
+{
+  if(ip->pcache == 0)
+    return;
+  for(int i = 0; i < PCSLOTS; i++){
+    if(ip->pcache[i])
+      kfree(PCPAGE(ip->pcache[i]));
+  }
+  kfree((void*)ip->pcache);
+  ip->pcache = 0;
+  ip->ndirty = 0;
+}
+
+// Note that cached page pgno of ip was modified through a
+// shared mapping. Caller must hold ip->lock.
+void
+pcmarkdirty(struct inode *ip, uint pgno)
+{
+  if(ip->pcache == 0 || pgno >= PCSLOTS || ip->pcache[pgno] == 0)
+    return;
+  if((ip->pcache[pgno] & PC_DIRTY) == 0){
+    ip->pcache[pgno] |= PC_DIRTY;
+    ip->ndirty++;
+  }
+}
+
+// Write the part of cached page pgno that lies inside the
+// file to its disk blocks. Pages do not extend the file.
+// Caller must hold ip->lock and be inside a transaction.
+static void
+pcwrite(struct inode *ip, uint pgno)
+{
+  char *pg = PCPAGE(ip->pcache[pgno]);
+  uint off, n, m, addr;
+  struct buf *bp;
+
+  off = pgno * PGSIZE;
+  if(off >= ip->size)
+    return;
+  n = min(ip->size - off, PGSIZE);
+  for(m = 0; m < n; m += BSIZE){
+    if((addr = bmap(ip, (off + m) / BSIZE)) == 0)
+      break;
+    bp = bread(ip->dev, addr);
+    memmove(bp->data, pg + m, min(n - m, BSIZE));
+    log_write(bp);
+    brelse(bp);
+  }
+}
+
+// Write the dirty cached pages of ip back to disk, as many
+// pages per log transaction as fit in MAXOPBLOCKS.
+// Caller must not hold ip->lock.
+void
+pcflush(struct inode *ip)
+{
+  // leave room for the inode block.
+  int batch = (MAXOPBLOCKS-1) / (PGSIZE/BSIZE);
+  uint pgno = 0;
+  int n, more;
+
+  do {
+    begin_op();
+    ilock(ip);
+    for(n = 0; n < batch && ip->ndirty > 0 && pgno < PCSLOTS; pgno++){
+      if(ip->pcache[pgno] & PC_DIRTY){
+        pcwrite(ip, pgno);
+        ip->pcache[pgno] &= ~PC_DIRTY;
+        ip->ndirty--;
+        n++;
+      }
+    }
+    more = ip->ndirty > 0 && pgno < PCSLOTS;
+    iunlock(ip);
+    end_op();
+  } while(more);
+}
+
+// Background writeback: every WBTICKS ticks, write back
+// the page cache of every inode with dirty pages.
+// Runs as a kernel process started by main().
+void
+pcflushd(void)
+{
+  struct inode *ip;
+  uint ticks0;
+
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  for(;;){
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < WBTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    for(int i = 0; i < NINODE; i++){
+      acquire(&itable.lock);
+      ip = &itable.inode[i];
+      // ndirty is only a hint here; pcflush() rechecks it.
+      if(ip->ref == 0 || ip->ndirty == 0){
+        release(&itable.lock);
+        continue;
+      }
+      ip->ref++;
+      release(&itable.lock);
+
+      pcflush(ip);
+      begin_op();
+      iput(ip);
+      end_op();
+    }
+  }
 }
 
 // Copy stat information from inode.
@@ -487,7 +754,30 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
-// Read data from inode.
+// Read data from inode blocks, bypassing the page cache.
+static int
+readblocks(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    uint addr = bmap(ip, off/BSIZE);
+    if(addr == 0)
+      break;
+    bp = bread(ip->dev, addr);
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+      brelse(bp);
+      tot = -1;
+      break;
+    }
+    brelse(bp);
+  }
+  return tot;
+}
+
+// Read data from inode, through the page cache.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
@@ -495,7 +785,7 @@ int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
-  struct buf *bp;
+  char *pg;
 
   if(off > ip->size || off + n < off)
     return 0;
@@ -503,17 +793,16 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
-      brelse(bp);
+    if((pg = pcget(ip, off/PGSIZE)) == 0){
+      // no memory for the cache: read the rest directly.
+      int r = readblocks(ip, user_dst, dst, off, n - tot);
+      return r < 0 ? -1 : tot + r;
+    }
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(either_copyout(user_dst, dst, pg + (off % PGSIZE), m) == -1) {
       tot = -1;
       break;
     }
-    brelse(bp);
   }
   return tot;
 }
@@ -546,6 +835,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    // keep an already cached copy of this page up to date.
+    if(ip->pcache && ip->pcache[off/PGSIZE])
+      memmove(PCPAGE(ip->pcache[off/PGSIZE]) + (off % PGSIZE),
+              bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
@@ -18,9 +18,27 @@ struct run {
   struct run *next;
 };
 
+// index of a physical page in kmem.ref[].
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+// freelist holds pages with arbitrary contents.
+// zerolist holds pages that idle harts have already
+// zeroed (apart from the run link), for kalloc_zeroed().
+// ref[] counts the page table mappings and kernel users
+// of each allocated page; kfree() only returns a page to
+// the free list when its count drops to zero, so a page
+// is on one of the lists exactly when its count is zero.
+// nhuge counts the 2 MiB blocks handed out by khugealloc().
+// lazy[] marks allocated pages given up with MADV_FREE.
 struct {
   struct spinlock lock;
   struct run *freelist;
+  struct run *zerolist;
+  int nfree;
+  int nzero;
+  int nhuge;
+  int ref[(PHYSTOP - KERNBASE) / PGSIZE];
+  uchar lazy[(PHYSTOP - KERNBASE) / PGSIZE];
 } kmem;
 
 void
@@ -35,14 +53,17 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kmem.ref[PA2REF(p)] = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when the last reference goes away.
 void
 kfree(void *pa)
 {
@@ -51,36 +72,298 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
-  // Fill with junk to catch dangling refs.
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] < 1)
+    panic("kfree: ref");
+  if(kmem.ref[PA2REF(pa)] > 1){
+    kmem.ref[PA2REF(pa)]--;
+    release(&kmem.lock);
+    return;
+  }
+
+#ifdef KALLOC_DEBUG
+  // Fill with junk to catch dangling refs. The page keeps its
+  // last reference until it is on the free list, so that
+  // khugealloc() does not count it free before then.
+  release(&kmem.lock);
   memset(pa, 1, PGSIZE);
+  acquire(&kmem.lock);
+#endif
 
   r = (struct run*)pa;
-
-  acquire(&kmem.lock);
+  kmem.ref[PA2REF(pa)] = 0;
+  kmem.lazy[PA2REF(pa)] = 0;
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
+  release(&kmem.lock);
+}
+
+// Take a page off the free list, or the zeroed pool if the
+// free list is empty. Returns 0 if both are.
+static struct run *
+kget(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = kmem.freelist;
+  if(r){
+    kmem.freelist = r->next;
+    kmem.nfree--;
+  } else if((r = kmem.zerolist) != 0){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+  }
+  if(r)
+    kmem.ref[PA2REF(r)] = 1;
   release(&kmem.lock);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// The contents of the page are undefined.
+// If memory runs out, a user process may sleep in oom()
+// until some is paged out or freed by killing a process.
 void *
 kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
+  while((r = kget()) == 0 && oom())
+    ;
+
+#ifdef KALLOC_DEBUG
   if(r)
-    kmem.freelist = r->next;
+    memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Allocate one zero-filled page of physical memory.
+// Takes a page from the pre-zeroed pool if there is one,
+// so the common case costs no memset.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = kmem.zerolist;
+  if(r){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+    kmem.ref[PA2REF(r)] = 1;
+  }
   release(&kmem.lock);
 
+  if(r){
+    r->next = 0;
+    return (void*)r;
+  }
+
+  r = kalloc();
   if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+    memset((char*)r, 0, PGSIZE);
   return (void*)r;
 }
 
+// Move one page from the free list to the zeroed pool.
+// Called by scheduler() on a hart that has nothing to run,
+// instead of wfi. Returns 1 if it zeroed a page, 0 if the
+// pool is full or there is no free memory to zero.
+int
+kzero_idle(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  if(kmem.nzero >= ZEROPOOL || (r = kmem.freelist) == 0){
+    release(&kmem.lock);
+    return 0;
+  }
+  kmem.freelist = r->next;
+  kmem.nfree--;
+  // keep khugealloc() away from the page while it is on
+  // neither list.
+  kmem.ref[PA2REF(r)] = 1;
+  release(&kmem.lock);
+
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  kmem.ref[PA2REF(r)] = 0;
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  kmem.nzero++;
+  release(&kmem.lock);
+  return 1;
+}
+
+// Unlink the pages in [base, base+MEGAPGSIZE) from *list.
+// Returns the number of pages removed.
+static int
+unlinkblock(struct run **list, uint64 base)
+{
+  struct run **rp, *r;
+  int n = 0;
+
+  for(rp = list; (r = *rp) != 0; ){
+    if((uint64)r >= base && (uint64)r < base + MEGAPGSIZE){
+      *rp = r->next;
+      n++;
+    } else {
+      rp = &r->next;
+    }
+  }
+  return n;
+}
+
+// Allocate 2 MiB of zero-filled, physically contiguous
+// memory aligned to 2 MiB, for a megapage mapping.
+// Each of the 512 pages gets a reference count of one,
+// so khugefree() (or kfree() on every page) releases it.
+// Returns 0 if no aligned 2 MiB block is entirely free.
+void *
+khugealloc(void)
+{
+  uint64 base;
+  int i, n;
+
+  acquire(&kmem.lock);
+  for(base = MEGAROUNDUP((uint64)end); base + MEGAPGSIZE <= PHYSTOP; base += MEGAPGSIZE){
+    for(i = 0; i < MEGAPGSIZE/PGSIZE; i++)
+      if(kmem.ref[PA2REF(base) + i] != 0)
+        break;
+    if(i == MEGAPGSIZE/PGSIZE)
+      break;
+  }
+  if(base + MEGAPGSIZE > PHYSTOP){
+    release(&kmem.lock);
+    return 0;
+  }
+
+  n = unlinkblock(&kmem.freelist, base);
+  i = unlinkblock(&kmem.zerolist, base);
+  kmem.nfree -= n;
+  kmem.nzero -= i;
+  if(n + i != MEGAPGSIZE/PGSIZE)
+    panic("khugealloc");
+  for(i = 0; i < MEGAPGSIZE/PGSIZE; i++)
+    kmem.ref[PA2REF(base) + i] = 1;
+  kmem.nhuge++;
+  release(&kmem.lock);
+
+  memset((char*)base, 0, MEGAPGSIZE);
+  return (void*)base;
+}
+
+// Free a block returned by khugealloc().
+void
+khugefree(void *pa)
+{
+  if(((uint64)pa % MEGAPGSIZE) != 0)
+    panic("khugefree");
+
+  acquire(&kmem.lock);
+  kmem.nhuge--;
+  release(&kmem.lock);
+
+  for(int i = 0; i < MEGAPGSIZE/PGSIZE; i++)
+    kfree((char*)pa + i*PGSIZE);
+}
+
+// The block at pa from khugealloc() is now mapped as 512
+// separate pages, each freed by kfree() on its own.
+void
+khugesplit(void *pa)
+{
+  if(((uint64)pa % MEGAPGSIZE) != 0)
+    panic("khugesplit");
+
+  acquire(&kmem.lock);
+  kmem.nhuge--;
+  release(&kmem.lock);
+}
+
+// Number of 2 MiB blocks currently allocated by khugealloc().
+int
+khugecount(void)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.nhuge;
+  release(&kmem.lock);
+  return n;
+}
+
+// Add a reference to an allocated page, e.g. when
+// fork shares it copy-on-write with a child.
+void
+krefinc(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("krefinc");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] < 1)
+    panic("krefinc: free page");
+  kmem.ref[PA2REF(pa)]++;
+  release(&kmem.lock);
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[PA2REF(pa)];
+  release(&kmem.lock);
+  return n;
+}
+
+// Mark the allocated page pa as given up with MADV_FREE
+// (on != 0), or remove the mark. Freeing the page removes
+// it too.
+void
+ksetlazy(void *pa, int on)
+{
+  acquire(&kmem.lock);
+  kmem.lazy[PA2REF(pa)] = on;
+  release(&kmem.lock);
+}
+
+// Is the allocated page pa marked by ksetlazy()?
+int
+kislazy(void *pa)
+{
+  int on;
+
+  acquire(&kmem.lock);
+  on = kmem.lazy[PA2REF(pa)];
+  release(&kmem.lock);
+  return on;
+}
+
+// Number of free pages, including the zeroed pool.
+// Unlike countfree(), does not walk the free list.
+int
+kfreepages(void)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.nfree + kmem.nzero;
+  release(&kmem.lock);
+  return n;
+}
+
 uint64
 countfree(void){
 	struct run *r;
@@ -91,6 +374,7 @@ countfree(void){
 		count++;
 		r=r->next;
 	}
+	count += kmem.nzero;
 	release(&kmem.lock);
 	return count;
 }
@@ -0,0 +1,327 @@
+// Same-page merging: ksmd, a kernel process, looks for identical
+// pages in the mmap areas that processes have marked with
+// madvise(MADV_MERGEABLE), and makes them share one read-only
+// copy, as fork() would; a write fault breaks the sharing again
+// (see cowfault()).
+//
+// Every KSMTICKS ticks, ksmd moves on by about KSMSCAN PTEs
+// through those areas. A page becomes a candidate once it has
+// gone a whole pass unwritten: ksmd clears PTE_D as it passes,
+// and a page whose PTE_D is still clear the next time round has
+// not changed. Zero-filled candidates are replaced by the shared
+// zero page. Others are hashed and looked up in two tables
+// indexed by the hash: the stable table of merged pages, to
+// which ksmd holds a reference, and the unstable table of the
+// candidates seen this pass. A candidate that matches a stable
+// page is merged into it; one that matches an unstable candidate
+// turns that one into a stable page first. Each table has one
+// entry per bucket, so a collision just forgets the older page.
+//
+// Like kswapd, ksmd changes a process's page table only while
+// it holds the process's lock and the process is not running.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define KSMBATCH 16   // candidates looked up per hold of a process's lock
+
+extern struct proc proc[NPROC];
+
+struct ksmpage {
+  uint h;           // hash of the contents
+  char *pa;         // the page, or 0 if the entry is empty
+  struct proc *p;   // unstable: the process that maps pa at va
+  int pid;
+  uint64 va;
+};
+
+struct {
+  struct spinlock lock;  // stable[], for ksminfo()
+  struct ksmpage stable[KSMHASH];
+  struct ksmpage unstable[KSMHASH];
+
+  // used only by ksmd.
+  int hand;              // index in proc[] of the process to scan
+  int merged;            // pages merged since boot
+} ksm;
+
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+}
+
+static uint
+ksmhash(char *pa)
+{
+  uint64 *w = (uint64*)pa, h = 0;
+
+  for(int i = 0; i < PGSIZE/sizeof(uint64); i++)
+    h = (h ^ w[i]) * 0x100000001b3UL;
+  return h ^ (h >> 32);
+}
+
+static int
+ksmzero(char *pa)
+{
+  uint64 *w = (uint64*)pa;
+
+  for(int i = 0; i < PGSIZE/sizeof(uint64); i++)
+    if(w[i])
+      return 0;
+  return 1;
+}
+
+// The PTE of va if it maps pa, a private page of p's, not
+// written since ksmd cleared its PTE_D; else 0.
+static pte_t *
+ksmpte(struct proc *p, uint64 va, char *pa)
+{
+  pte_t *pte;
+
+  if((pte = walk(p->pagetable, va, 0)) == 0)
+    return 0;
+  if((*pte & (PTE_V|PTE_U|PTE_D|PTE_MEGA)) != (PTE_V|PTE_U) ||
+     PTE2PA(*pte) != (uint64)pa || krefcnt(pa) != 1 || kislazy(pa))
+    return 0;
+  return pte;
+}
+
+// Merge the candidate pa that p maps at va into stable page s,
+// or into the zero page if s is 0, if p still maps it unchanged
+// and it has s's contents. Returns 1 if merged, else 0.
+// The caller holds p->lock, and p is not running.
+static int
+ksmmerge(struct proc *p, uint64 va, char *pa, char *s)
+{
+  pte_t *pte;
+
+  if((pte = ksmpte(p, va, pa)) == 0)
+    return 0;
+  if(s ? memcmp(pa, s, PGSIZE) != 0 : !ksmzero(pa))
+    return 0;
+  uvmshare(pte, s);
+  kfree(pa);
+  tlbshootdown(p);
+  ksm.merged++;
+  return 1;
+}
+
+// Put page s, with hash h, in the stable table, taking over the
+// reference the caller holds to it.
+static void
+ksmstable(uint h, char *s)
+{
+  struct ksmpage *e = &ksm.stable[h % KSMHASH];
+  char *old;
+
+  acquire(&ksm.lock);
+  old = e->pa;
+  e->h = h;
+  e->pa = s;
+  release(&ksm.lock);
+  if(old)
+    kfree(old);
+}
+
+// Make the unstable candidate u a stable page, if its process
+// still maps it unchanged and it has the contents of pa: the
+// PTE becomes read-only, and ksmd takes a reference. Returns
+// the page, or 0.
+static char *
+ksmpromote(struct ksmpage *u, char *pa)
+{
+  struct proc *q = u->p;
+  char *s = 0;
+  pte_t *pte;
+
+  acquire(&q->lock);
+  if(q->pid == u->pid && (q->state == RUNNABLE || q->state == SLEEPING) &&
+     (pte = ksmpte(q, u->va, u->pa)) != 0 && memcmp(u->pa, pa, PGSIZE) == 0){
+    // the PTE's reference stays; uvmshare() adds ksmd's.
+    uvmshare(pte, u->pa);
+    tlbshootdown(q);
+    s = u->pa;
+  }
+  release(&q->lock);
+  if(s)
+    ksmstable(u->h, s);
+  return s;
+}
+
+// The start of the next part of p's memory at or after va that
+// was marked MADV_MERGEABLE, or MAXVA if there is none. Sets
+// *end to its end.
+static uint64
+ksmregion(struct proc *p, uint64 va, uint64 *end)
+{
+  struct mmap_area *ma;
+  uint64 s, e;
+
+  for(int i = 0; i < p->nmmap; i++){
+    ma = &p->mmap_areas[i];
+    s = MMAPBASE + ma->addr;
+    e = s + ma->length;
+    if(!ma->merge || e <= va)
+      continue;
+    *end = e;
+    return va > s ? va : s;
+  }
+  return MAXVA;
+}
+
+// Move p's scan position over up to KSMSCAN PTEs, clearing
+// PTE_D of written pages, merging zero-filled candidates and
+// those matching a stable page, and collecting up to KSMBATCH
+// other candidates in c[]. Sets *nc to how many, and *n to the
+// number of PTEs looked at. Returns 1 if the scan reached the
+// end of p's memory, else 0. The caller holds p->lock.
+static int
+ksmclock(struct proc *p, struct ksmpage *c, int *nc, int *n)
+{
+  uint64 va, end, next;
+  struct ksmpage *e;
+  pte_t *pte;
+  char *pa;
+  int done = 0, flush = 0;
+  uint h;
+
+  va = p->ksmva;
+  end = 0;
+  for(*n = 0; *n < KSMSCAN && *nc < KSMBATCH; (*n)++){
+    if(va >= end && (va = ksmregion(p, va, &end)) == MAXVA){
+      done = 1;
+      break;
+    }
+    if((pte = walkrange(p->pagetable, va, &next)) == 0 || (*pte & PTE_MEGA)){
+      va = next;
+      continue;
+    }
+    pa = (char*)PTE2PA(*pte);
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) || krefcnt(pa) != 1 || kislazy(pa)){
+      // not mapped, or already shared.
+    } else if(*pte & PTE_D){
+      *pte &= ~PTE_D;
+      flush = 1;
+    } else if(ksmzero(pa)){
+      ksmmerge(p, va, pa, 0);
+    } else {
+      h = ksmhash(pa);
+      e = &ksm.stable[h % KSMHASH];
+      if(e->pa == 0 || e->h != h || !ksmmerge(p, va, pa, e->pa)){
+        c[*nc].h = h;
+        c[*nc].pa = pa;
+        c[*nc].va = va;
+        (*nc)++;
+      }
+    }
+    va += PGSIZE;
+  }
+  p->ksmva = done ? 0 : va;
+  if(flush)
+    tlbshootdown(p);
+  return done;
+}
+
+// Start a new pass: forget the unstable candidates, and free the
+// stable pages that nobody maps any more.
+static void
+ksmpass(void)
+{
+  struct ksmpage *e;
+  char *pa;
+
+  memset(ksm.unstable, 0, sizeof(ksm.unstable));
+  for(e = ksm.stable; e < &ksm.stable[KSMHASH]; e++){
+    if(e->pa == 0 || krefcnt(e->pa) > 1)
+      continue;
+    acquire(&ksm.lock);
+    pa = e->pa;
+    e->pa = 0;
+    release(&ksm.lock);
+    kfree(pa);
+  }
+}
+
+// Scan part of the memory of proc[ksm.hand], going on to the
+// next process when done with it. Returns the number of PTEs
+// looked at, plus one.
+static int
+ksmscan(void)
+{
+  struct proc *p = &proc[ksm.hand];
+  struct ksmpage c[KSMBATCH], *u;
+  int i, pid, done = 1, nc = 0, n = 0;
+  char *s;
+
+  acquire(&p->lock);
+  if(p->state == RUNNABLE || p->state == SLEEPING)
+    done = ksmclock(p, c, &nc, &n);
+  pid = p->pid;
+  release(&p->lock);
+
+  for(i = 0; i < nc; i++){
+    u = &ksm.unstable[c[i].h % KSMHASH];
+    if(u->pa && u->h == c[i].h && !(u->p == p && u->va == c[i].va) &&
+       (s = ksmpromote(u, c[i].pa)) != 0){
+      acquire(&p->lock);
+      if(p->pid == pid && (p->state == RUNNABLE || p->state == SLEEPING))
+        ksmmerge(p, c[i].va, c[i].pa, s);
+      release(&p->lock);
+      u->pa = 0;
+    } else {
+      *u = c[i];
+      u->p = p;
+      u->pid = pid;
+    }
+  }
+
+  if(done && (ksm.hand = (ksm.hand + 1) % NPROC) == 0)
+    ksmpass();
+  return n + 1;
+}
+
+// Same-page merging daemon.
+// Runs as a kernel process started by main().
+void
+ksmd(void)
+{
+  uint ticks0;
+
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  for(;;){
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < KSMTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    for(int n = 0; n < KSMSCAN; )
+      n += ksmscan();
+  }
+}
+
+// Print merging statistics, for meminfo().
+void
+ksminfo(void)
+{
+  int shared = 0, sharing = 0;
+
+  acquire(&ksm.lock);
+  for(int i = 0; i < KSMHASH; i++){
+    if(ksm.stable[i].pa){
+      shared++;
+      sharing += krefcnt(ksm.stable[i].pa) - 1;
+    }
+  }
+  release(&ksm.lock);
+  printf("ksm %d shared pages mapped %d times, %d pages merged\n",
+         shared, sharing, ksm.merged);
+}
@@ -0,0 +1,160 @@
+// LZ77 compression of pages for the compressed swap pool,
+// in a byte format much like LZ4's blocks.
+//
+// The compressed data is a series of sequences. Each starts
+// with a token byte, whose high four bits give a number of
+// literal bytes and low four bits the length of a match less
+// LZMINMATCH. A field of 15 continues in following bytes,
+// which are added to it up to and including the first that
+// is not 255. The literal bytes come next, then, except in
+// the last sequence, the match's two-byte little-endian
+// offset back into the output, then the match length bytes.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define LZMINMATCH 4
+#define LZMAXOFF 65535
+
+static uint
+lzload(const uchar *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint)p[3] << 24;
+}
+
+static uint
+lzhash(uint v)
+{
+  return (v * 2654435761U) >> (32 - LZHASHBITS);
+}
+
+// append the continuation bytes of a length field.
+static uchar *
+lzlen(uchar *op, int n)
+{
+  for(; n >= 255; n -= 255)
+    *op++ = 255;
+  *op++ = n;
+  return op;
+}
+
+// Append a sequence of nlit literals from lit followed, if
+// off is not 0, by a match of mlen bytes off bytes back.
+// Returns the new end of the output, or 0 if it would pass
+// oend.
+static uchar *
+lzseq(uchar *op, uchar *oend, const uchar *lit, int nlit, int off, int mlen)
+{
+  uchar *token;
+  int ml = mlen - LZMINMATCH;
+
+  if(oend - op < 1 + nlit/255 + 1 + nlit + 2 + ml/255 + 1)
+    return 0;
+  token = op++;
+  *token = (nlit >= 15 ? 15 : nlit) << 4;
+  if(nlit >= 15)
+    op = lzlen(op, nlit - 15);
+  memmove(op, lit, nlit);
+  op += nlit;
+  if(off){
+    *op++ = off;
+    *op++ = off >> 8;
+    *token |= ml >= 15 ? 15 : ml;
+    if(ml >= 15)
+      op = lzlen(op, ml - 15);
+  }
+  return op;
+}
+
+// Compress the n bytes at src into dst, which has room for
+// max bytes. tab is the caller's hash table of 1<<LZHASHBITS
+// entries. Returns the compressed length, or -1 if it would
+// be more than max.
+int
+lz_compress(const uchar *src, int n, uchar *dst, int max, ushort *tab)
+{
+  const uchar *ip = src, *anchor = src, *end = src + n;
+  const uchar *ref, *mp, *rp;
+  uchar *op = dst, *oend = dst + max;
+  uint v, h;
+
+  if(n > LZMAXOFF + 1)
+    panic("lz_compress");
+  memset(tab, 0, sizeof(ushort) << LZHASHBITS);
+  while(end - ip >= LZMINMATCH){
+    v = lzload(ip);
+    h = lzhash(v);
+    ref = src + tab[h];
+    tab[h] = ip - src;
+    if(ref >= ip || lzload(ref) != v){
+      ip++;
+      continue;
+    }
+    for(mp = ip + LZMINMATCH, rp = ref + LZMINMATCH; mp < end && *mp == *rp; mp++, rp++)
+      ;
+    if((op = lzseq(op, oend, anchor, ip - anchor, ip - ref, mp - ip)) == 0)
+      return -1;
+    ip = anchor = mp;
+  }
+  if((op = lzseq(op, oend, anchor, end - anchor, 0, 0)) == 0)
+    return -1;
+  return op - dst;
+}
+
+// read the continuation bytes of a length field into *n.
+// returns 0, or -1 if they run past iend.
+static int
+lzreadlen(const uchar **ip, const uchar *iend, int *n)
+{
+  int b;
+
+  do {
+    if(*ip >= iend)
+      return -1;
+    b = *(*ip)++;
+    *n += b;
+  } while(b == 255);
+  return 0;
+}
+
+// Decompress the n bytes at src into dst, which has room for
+// max bytes. Returns the decompressed length, or -1 if src is
+// not valid compressed data or decompresses to more than max.
+int
+lz_decompress(const uchar *src, int n, uchar *dst, int max)
+{
+  const uchar *ip = src, *iend = src + n;
+  uchar *op = dst, *oend = dst + max, *ref;
+  int token, len, off;
+
+  while(ip < iend){
+    token = *ip++;
+    len = token >> 4;
+    if(len == 15 && lzreadlen(&ip, iend, &len) < 0)
+      return -1;
+    if(len > iend - ip || len > oend - op)
+      return -1;
+    memmove(op, ip, len);
+    op += len;
+    ip += len;
+    if(ip == iend)
+      break;
+
+    if(iend - ip < 2)
+      return -1;
+    off = ip[0] | ip[1] << 8;
+    ip += 2;
+    len = token & 15;
+    if(len == 15 && lzreadlen(&ip, iend, &len) < 0)
+      return -1;
+    len += LZMINMATCH;
+    if(off == 0 || off > op - dst || len > oend - op)
+      return -1;
+    // the match may overlap the bytes it produces.
+    for(ref = op - off; len > 0; len--)
+      *op++ = *ref++;
+  }
+  return op - dst;
+}
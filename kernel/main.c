@@ -28,7 +28,15 @@ main()
     iinit();         // inode table
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
+    swapinit();      // swap area after the file system
+    zswapinit();     // compressed swap pool
+    ksminit();       // same-page merging
+    oominit();       // out-of-memory killer
     userinit();      // first user process
+    kthread("pcflushd", pcflushd); // page cache writeback
+    kthread("pcreadd", pcreadd);   // page cache readahead
+    kthread("kswapd", kswapd);     // page-out to swap
+    kthread("ksmd", ksmd);         // same-page merging
     __sync_synchronize();
     started = 1;
   } else {
@@ -51,9 +51,12 @@
 // Address zero first:
 //   text
 //   original data and bss
-//   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap areas, from MMAPBASE
+//   ...
+//   stack, growing down from USTACKTOP
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define USTACKTOP TRAPFRAME
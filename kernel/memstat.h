@@ -0,0 +1,7 @@
+// A process's memory use, in pages, from memstat().
+struct memstat {
+  int rss;          // resident user pages, a megapage counting as 512
+  int mmpages;      // resident pages of mmap areas, part of rss
+  int ptpages;      // page-table pages
+  uint64 rsslimit;  // most resident pages, or RLIM_INFINITY
+};
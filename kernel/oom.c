@@ -0,0 +1,158 @@
+// Out-of-memory handling. When kalloc() finds no free page for a
+// user process that may sleep, oom() first waits for kswapd to
+// page some memory out. If kswapd cannot, it kills the process
+// with the highest badness and waits for its pages to come back.
+//
+// A process's badness is its resident pages plus oomadj
+// thousandths of all of memory, so oomadj(), from OOMADJMIN to
+// OOMADJMAX, steers the choice; OOMADJMIN exempts a process.
+// init and kernel processes are never chosen.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+extern struct proc proc[NPROC];
+extern struct proc *initproc;
+
+// one caller at a time chooses a victim.
+static struct spinlock oomlock;
+
+void
+oominit(void)
+{
+  initlock(&oomlock, "oom");
+}
+
+// The pid of a process killed before that has yet to exit and
+// free its memory, or 0. The caller holds oomlock.
+static int
+oomdying(void)
+{
+  struct proc *p;
+  int pid = 0;
+
+  for(p = proc; p < &proc[NPROC] && pid == 0; p++){
+    acquire(&p->lock);
+    if(p->killed && p->state != UNUSED && p->state != ZOMBIE && p->sz > 0)
+      pid = p->pid;
+    release(&p->lock);
+  }
+  return pid;
+}
+
+// Kill the process with the highest badness, logging every
+// candidate's resident pages, unless a process killed before
+// is still exiting. Returns the pid of the process killed or
+// exiting, or 0 if there is none.
+static int
+oomkill(void)
+{
+  struct proc *p, *victim = 0;
+  long badness, worst = 0;
+  int pid, rss, vrss = 0;
+  char name[16];
+
+  acquire(&oomlock);
+  if((pid = oomdying()) != 0){
+    release(&oomlock);
+    return pid;
+  }
+
+  printf("oom: out of memory; pid, resident pages, oomadj, name:\n");
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->state == UNUSED || p->state == ZOMBIE || p == initproc || p->sz == 0){
+      release(&p->lock);
+      continue;
+    }
+    rss = p->rss;
+    printf("oom: %d %d %d %s\n", p->pid, rss, p->oomadj, p->name);
+    badness = rss + (long)p->oomadj * ((PHYSTOP - KERNBASE) / PGSIZE) / 1000;
+    if(badness < 1)
+      badness = 1;
+    if(rss > 0 && p->oomadj > OOMADJMIN && badness > worst){
+      worst = badness;
+      victim = p;
+      pid = p->pid;
+      vrss = rss;
+      safestrcpy(name, p->name, sizeof(name));
+    }
+    release(&p->lock);
+  }
+
+  if(victim){
+    acquire(&victim->lock);
+    if(victim->pid == pid){
+      victim->killed = 1;
+      if(victim->state == SLEEPING)
+        victim->state = RUNNABLE;
+    } else {
+      pid = 0;   // exited meanwhile
+    }
+    release(&victim->lock);
+  }
+  release(&oomlock);
+
+  if(pid > 0)
+    printf("oom: killed pid %d (%s) with %d resident pages\n", pid, name, vrss);
+  else
+    printf("oom: no process to kill\n");
+  return pid;
+}
+
+// Called by kalloc() when memory runs out. If the caller is a
+// user process that holds no spinlock, and so may sleep, wait
+// for kswapd or kill a victim to get memory back. Returns 1 if
+// the allocation should be retried, or 0 if it should fail.
+int
+oom(void)
+{
+  struct proc *p = myproc();
+  uint ticks0;
+
+  // kernel processes free memory themselves and must not wait.
+  if(p == 0 || p->sz == 0 || holdinglocks() || killed(p))
+    return 0;
+  if(swapwait() || kfreepages() > 0)
+    return 1;
+  if(oomkill() <= 0 || killed(p))
+    return 0;
+
+  // the victim frees its memory as it exits. Give up after a
+  // while, since it may be waiting for a lock the caller holds.
+  acquire(&tickslock);
+  ticks0 = ticks;
+  while(kfreepages() == 0 && ticks - ticks0 < OOMWAIT && !killed(p))
+    sleep(&ticks, &tickslock);
+  release(&tickslock);
+  return kfreepages() > 0;
+}
+
+// Set the oom adjustment of the process pid, or of the caller
+// if pid is 0. Children inherit it. Returns 0, or -1 if there
+// is no such process or adj is out of range.
+int
+oomadj(int pid, int adj)
+{
+  struct proc *p;
+
+  if(adj < OOMADJMIN || adj > OOMADJMAX)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->oomadj = adj;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
@@ -6,15 +6,54 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NEXECSEG      4  // segments exec pages in on demand; more are read at once
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
-#define USERSTACK    1     // user stack pages
+#define USERSTACK    1     // user stack pages exec allocates, for the arguments
+#define USTACKMAX    (8*1024*1024)  // bytes the user stack may grow to
+#define USTACKGAP    (1024*1024)    // bytes below it kept unmapped
+#define ZEROPOOL     256   // pre-zeroed pages kept by idle harts
+#define PROT_NONE 0x0
 #define PROT_READ 0x1
 #define PROT_WRITE 0x2
 #define MAP_ANONYMOUS 0x1
 #define MAP_POPULATE 0x2
+#define MAP_HUGE 0x4
+#define MAP_SHARED 0x8
+#define MAP_PRIVATE 0x10  // the default for file mappings
+#define MAP_STACK 0x20    // the user stack, set up by exec
+#define MREMAP_MAYMOVE 0x1
+#define MADV_NORMAL 0
+#define MADV_RANDOM 1     // no fault-around or readahead
+#define MADV_SEQUENTIAL 2 // full readahead from the first fault
+#define MADV_WILLNEED 3   // map the pages now
+#define MADV_DONTNEED 4   // free the pages now
+#define MADV_FREE 8       // free the pages if memory runs low
+#define MADV_MERGEABLE 12   // let ksmd merge identical pages
+#define MADV_UNMERGEABLE 13 // stop merging them
+#define WBTICKS 10  // ticks between writebacks of shared file mappings
+#define FAULTAROUND 16  // aligned block of cached pages mapped per file fault
+#define RAMIN 4     // readahead window in pages after a random fault
+#define RAMAX 32    // largest readahead window for sequential faults
+#define NREADAHEAD 16  // queued readahead requests
+#define FREELOW 128  // free pages below which MADV_FREE pages are reclaimed
+#define NSWAP 16384  // swap slots of one page, on disk after the file system
+#define SWAPBATCH 16 // pages written by one swap-out disk request
+#define SWAPLOW 256  // free pages below which kswapd pages out
+#define SWAPHIGH 512 // free pages kswapd pages out until
+#define SWAPSCAN 512 // PTEs kswapd looks at per hold of a process's lock
+#define ZSWAPPAGES 4096 // most pages the compressed swap pool may use
+#define LZHASHBITS 12   // log2 of the entries in lz_compress()'s hash table
+#define KSMTICKS 10  // ticks between ksmd's scans
+#define KSMSCAN 256  // PTEs ksmd looks at per scan
+#define KSMHASH 1024 // buckets in each of ksmd's page tables
+#define OOMADJMIN (-1000) // oomadj() value that exempts a process from the oom killer
+#define OOMADJMAX 1000    // oomadj() value that makes a process its first victim
+#define OOMWAIT 20   // ticks to wait for an oom victim to free memory
+#define RLIMIT_RSS 0 // setrlimit(): most resident memory, in bytes
+#define RLIM_INFINITY (~0UL)
 #define MAX_MMAP_AREAS 64
 #define MMAPBASE 0x40000000UL
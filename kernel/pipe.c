@@ -73,58 +73,91 @@ pipeclose(struct pipe *pi, int writable)
     release(&pi->lock);
 }
 
+// The user's data is copied through buf[] without pi->lock
+// held, since the copy may have to read the page in from swap.
+// Copies stop at page boundaries, so that a bad address
+// costs only the bytes from it on.
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, j, m;
   struct proc *pr = myproc();
+  char buf[PIPESIZE];
 
-  acquire(&pi->lock);
   while(i < n){
-    if(pi->readopen == 0 || killed(pr)){
-      release(&pi->lock);
-      return -1;
-    }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+    m = n - i < PIPESIZE ? n - i : PIPESIZE;
+    if(m > PGSIZE - (addr + i) % PGSIZE)
+      m = PGSIZE - (addr + i) % PGSIZE;
+    if(copyin(pr->pagetable, buf, addr + i, m) == -1)
+      break;
+    acquire(&pi->lock);
+    for(j = 0; j < m; ){
+      if(pi->readopen == 0 || killed(pr)){
+        release(&pi->lock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
+      } else {
+        pi->data[pi->nwrite++ % PIPESIZE] = buf[j++];
+      }
     }
+    wakeup(&pi->nread);
+    release(&pi->lock);
+    i += m;
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
 
+// The bytes are copied out of the ring into buf[] but stay in
+// the pipe until copyout() has succeeded, so that a bad address
+// loses nothing. If another reader took them meanwhile, try
+// again with what is left.
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m, done;
+  uint r;
   struct proc *pr = myproc();
-  char ch;
+  char buf[PIPESIZE];
 
-  acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(killed(pr)){
-      release(&pi->lock);
+  for(;;){
+    acquire(&pi->lock);
+    while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+      if(killed(pr)){
+        release(&pi->lock);
+        return -1;
+      }
+      sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    }
+    r = pi->nread;
+    for(i = 0; i < n && i < PIPESIZE; i++){  //DOC: piperead-copy
+      if(r + i == pi->nwrite)
+        break;
+      buf[i] = pi->data[(r + i) % PIPESIZE];
+    }
+    release(&pi->lock);
+
+    // copy a page at a time, keeping what got through.
+    for(done = 0; done < i; done += m){
+      m = i - done;
+      if(m > PGSIZE - (addr + done) % PGSIZE)
+        m = PGSIZE - (addr + done) % PGSIZE;
+      if(copyout(pr->pagetable, addr + done, buf + done, m) == -1)
+        break;
+    }
+    if(i > 0 && done == 0)
       return -1;
+
+    acquire(&pi->lock);
+    if(pi->nread == r){
+      pi->nread += done;
+      wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+      release(&pi->lock);
+      return done;
     }
-    sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
-  }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+    release(&pi->lock);
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
-  release(&pi->lock);
-  return i;
 }
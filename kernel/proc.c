@@ -5,8 +5,10 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
-#include "file.h"
+#include "sleeplock.h"
 #include "fs.h"
+#include "file.h"
+#include "memstat.h"
 
 
 #define MAX_NAME_LEN 16
@@ -22,6 +24,8 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static int mmap_copy(struct proc *p, struct proc *np);
+static void asidinit(void);
 
 extern char trampoline[]; // trampoline.S
 
@@ -74,15 +78,13 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  
-  initlock(&mmap_manager.lock, "mmap_manager");
-  memset(mmap_manager.areas, 0, sizeof(mmap_manager.areas));
 
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
       p->kstack = KSTACK((int) (p - proc));
   }
+  asidinit();
 }
 
 // Must be called with interrupts disabled,
@@ -163,16 +165,28 @@ found:
   if(parent){
     p->vruntime = parent->vruntime;
     p->nice = parent->nice;
+    p->oomadj = parent->oomadj;
+    p->rsslimit = parent->rsslimit;
   }
   else{
     p->vruntime = 0;
     p->nice = 20;
+    p->oomadj = 0;
+    p->rsslimit = RLIM_INFINITY;
   }
   p->weight = get_weight_from_nice(p->nice);
   p->runtime = 0;
   p->timeslice = 5;
   update_vdeadline(p);
-  p->mmap_cursor = 0;  
+  p->nmmap = 0;
+  p->mmap_hint = 0;
+  p->nlazy = 0;
+  p->asid = 0;
+  p->asidcpu = -1;
+  p->swapva = 0;
+  p->ksmva = 0;
+  p->exe = 0;
+  p->nseg = 0;
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
     freeproc(p);
@@ -187,6 +201,7 @@ found:
     release(&p->lock);
     return 0;
   }
+  vmrecount(p);
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -206,9 +221,13 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
+  if(p->pagetable){
+    pagetable_t pagetable = p->pagetable;
+    // so that ptowner() cannot find p once the pages are reused.
+    p->pagetable = 0;
+    mmap_unmapall(p, pagetable);
+    proc_freepagetable(pagetable, p->sz);
+  }
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
@@ -216,7 +235,9 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
-  p->mmap_cursor = 0;
+  p->nmmap = 0;
+  p->nseg = 0;
+  p->rss = p->mmpages = p->ptpages = 0;
   p->state = UNUSED;
 }
 
@@ -280,6 +301,22 @@ userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel process that runs fn(), which never returns
+// and never enters user space. Like forkret(), fn() starts
+// out holding its p->lock from scheduler() and must release it.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->context.ra = (uint64)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -290,11 +327,16 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
+    if(!mmap_heapfits(p, sz + n))
+      return -1;
+    if(p->rss + (PGROUNDUP(sz + n) - PGROUNDUP(sz))/PGSIZE > p->rsslimit)
+      return -1;
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
       return -1;
     }
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    tlbshootdown(p);
   }
   p->sz = sz;
   return 0;
@@ -322,6 +364,13 @@ kfork(void)
   }
   np->sz = p->sz;
 
+  // Copy the mmap areas, sharing or copy-on-write.
+  if(mmap_copy(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -333,11 +382,14 @@ kfork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = idup(p->exe);
+  memmove(np->segs, p->segs, sizeof(p->segs));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
-  np->mmap_cursor = p->mmap_cursor;
   release(&np->lock);
 
   acquire(&wait_lock);
@@ -351,6 +403,60 @@ kfork(void)
   return pid;
 }
 
+// Create a new process running the program at path with
+// arguments argv. Unlike fork() then exec(), this never copies
+// the caller's page table or mmap areas: the child starts with
+// an empty one that kexec() fills in. If fds is 0 the child
+// gets all of the caller's open files; otherwise its descriptor
+// i, for i < nfds, is the caller's descriptor fds[i], or closed
+// if that is -1, and it has no others.
+// Returns the child's pid, or -1.
+int
+kspawn(char *path, char **argv, int *fds, int nfds)
+{
+  int i, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  for(i = 0; fds && i < nfds; i++)
+    if(fds[i] != -1 && (fds[i] < 0 || fds[i] >= NOFILE || p->ofile[fds[i]] == 0))
+      return -1;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  // kexec() sleeps; nothing else uses np before it is RUNNABLE.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = kexec(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  // main(argc, argv); kexec() set a1.
+  np->trapframe->a0 = argc;
+
+  for(i = 0; i < NOFILE; i++){
+    if(fds == 0 && p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+    else if(fds && i < nfds && fds[i] != -1)
+      np->ofile[i] = filedup(p->ofile[fds[i]]);
+  }
+  np->cwd = idup(p->cwd);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  pid = np->pid;
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -386,10 +492,17 @@ kexit(int status)
     }
   }
 
+  // Unmap mmap areas here rather than in freeproc(), since
+  // closing their files may sleep.
+  mmap_unmapall(p, p->pagetable);
+
   begin_op();
   iput(p->cwd);
+  if(p->exe)
+    iput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
   acquire(&p->lock);
@@ -535,7 +648,8 @@ scheduler(void)
       c->proc = 0;
       release(&next_proc->lock);
     }
-    else asm volatile("wfi");
+    else if(kzero_idle() == 0)
+      asm volatile("wfi");
   }
 }
 
@@ -601,7 +715,7 @@ forkret(void)
     
     // We can invoke kexec() now that file system is initialized.
     // Put the return value (argc) of kexec into a0.
-    p->trapframe->a0 = kexec("/init", (char *[]){ "/init", 0 });
+    p->trapframe->a0 = kexec(p, "/init", (char *[]){ "/init", 0 });
     if (p->trapframe->a0 == -1) {
       panic("exec");
     }
@@ -609,7 +723,7 @@ forkret(void)
   
   // return to user space, mimicing usertrap()'s return.
   prepare_return();
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = procsatp(p);
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
   ((void (*)(uint64))trampoline_userret)(satp);
 }
@@ -967,15 +1081,74 @@ void ps(int pid)
 
 int meminfo(void)
 {
+	struct proc *p;
 	uint64 free_pages;
 	uint64 total_bytes;
+	int huge;
 
 	free_pages = countfree();
+	huge = khugecount();
+	printf("free %d pages, huge %d (%d KB)\n",
+	       (int)free_pages, huge, huge * (MEGAPGSIZE / 1024));
+	zswapinfo();
+	ksminfo();
+	for(p = proc; p < &proc[NPROC]; p++){
+		acquire(&p->lock);
+		if(p->state != UNUSED && p->state != ZOMBIE && p->sz > 0)
+			printf("pid %d %s: rss %d pages (%d mmap), %d page-table pages\n",
+			       p->pid, p->name, p->rss, p->mmpages, p->ptpages);
+		release(&p->lock);
+	}
 
 	total_bytes = free_pages * PGSIZE;
 	return total_bytes;
 }
 
+// Copy the memory use of process pid, or of the caller if
+// pid is 0, to st, a user address of a struct memstat.
+// Returns 0, or -1 if there is no such process.
+int
+memstat(int pid, uint64 addr)
+{
+	struct proc *p, *me = myproc();
+	struct memstat st;
+
+	if(pid == 0)
+		pid = me->pid;
+	for(p = proc; p < &proc[NPROC]; p++){
+		acquire(&p->lock);
+		if(p->pid == pid && p->state != UNUSED){
+			st.rss = p->rss;
+			st.mmpages = p->mmpages;
+			st.ptpages = p->ptpages;
+			st.rsslimit = p->rsslimit;
+			release(&p->lock);
+			return copyout(me->pagetable, addr, (char *)&st, sizeof(st));
+		}
+		release(&p->lock);
+	}
+	return -1;
+}
+
+// Limit the caller's use of resource to max: for RLIMIT_RSS,
+// max bytes of resident memory, rounded down to whole pages,
+// or RLIM_INFINITY. A fault that would go over the limit fails,
+// as does sbrk(); a limit below the current RSS stops growth
+// until enough is unmapped. Children inherit the limit.
+// Returns 0, or -1 for an unknown resource.
+int
+setrlimit(int resource, uint64 max)
+{
+	struct proc *p = myproc();
+
+	if(resource != RLIMIT_RSS)
+		return -1;
+	acquire(&p->lock);
+	p->rsslimit = max == RLIM_INFINITY ? RLIM_INFINITY : max / PGSIZE;
+	release(&p->lock);
+	return 0;
+}
+
 int waitpid(int pid){
 	int found_process;
 	struct proc *pp, *target_proc = 0;
@@ -1005,15 +1178,206 @@ int waitpid(int pid){
 	}
 }
 
+// p->mmap_areas[0..p->nmmap) are kept sorted by address
+// and never overlap, so the area holding an address is found
+// by binary search. p->mmap_hint caches the index of the last
+// area found, which page faults usually hit again.
+// Area addresses are offsets from MMAPBASE.
+
+// Return the index of the first area of p at or above offset addr.
+static int
+mmap_index(struct proc *p, uint64 addr)
+{
+  int lo = 0, hi = p->nmmap;
+
+  while(lo < hi){
+    int mid = (lo + hi) / 2;
+    if(p->mmap_areas[mid].addr < addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Return the area of p containing user address va, or 0.
+struct mmap_area*
+mmap_lookup(struct proc *p, uint64 va)
+{
+  struct mmap_area *ma;
+  int i;
+
+  if(va < MMAPBASE)
+    return 0;
+  va -= MMAPBASE;
+
+  if(p->mmap_hint < p->nmmap){
+    ma = &p->mmap_areas[p->mmap_hint];
+    if(va >= ma->addr && va < ma->addr + ma->length)
+      return ma;
+  }
+  // the last area starting at or below va.
+  i = mmap_index(p, va + 1) - 1;
+  if(i < 0)
+    return 0;
+  ma = &p->mmap_areas[i];
+  if(va >= ma->addr + ma->length)
+    return 0;
+  p->mmap_hint = i;
+  return ma;
+}
+
+// The lowest offset that the area below ma may reach. Nothing
+// is mapped in the USTACKGAP bytes below the stack, so that
+// overflowing it faults instead of running into another area.
+static uint64
+mmap_floor(struct mmap_area *ma)
+{
+  if((ma->flags & MAP_STACK) && ma->addr >= USTACKGAP)
+    return ma->addr - USTACKGAP;
+  return ma->addr;
+}
+
+// The lowest offset an area of p may start at: 0, unless a
+// lazy sbrk() has taken the heap past MMAPBASE.
+static uint64
+mmap_heaptop(struct proc *p)
+{
+  uint64 top = PGROUNDUP(p->sz);
+
+  return top > MMAPBASE ? top - MMAPBASE : 0;
+}
+
+// Whether p's heap may grow to newsz bytes without running
+// into its lowest area. For sbrk().
+int
+mmap_heapfits(struct proc *p, uint64 newsz)
+{
+  int ok;
+
+  acquire(&p->lock);
+  ok = newsz <= MMAPBASE || p->nmmap == 0 ||
+       PGROUNDUP(newsz) - MMAPBASE <= mmap_floor(&p->mmap_areas[0]);
+  release(&p->lock);
+  return ok;
+}
+
+// Find the lowest gap between p's areas, above its heap, that
+// can hold length bytes at the given alignment. Returns its
+// offset from MMAPBASE, or -1 if the address space is full.
+static uint64
+mmap_findgap(struct proc *p, uint64 length, uint64 align)
+{
+  uint64 start = mmap_heaptop(p), end;
+
+  for(int i = 0; i <= p->nmmap; i++){
+    end = i < p->nmmap ? mmap_floor(&p->mmap_areas[i]) : TRAPFRAME - MMAPBASE;
+    start = (start + align - 1) & ~(align - 1);
+    if(start <= end && end - start >= length)
+      return start;
+    if(i < p->nmmap)
+      start = p->mmap_areas[i].addr + p->mmap_areas[i].length;
+  }
+  return -1;
+}
+
+// Insert an area of p for [addr, addr+length), keeping the
+// array sorted. Returns the new, otherwise uninitialized
+// area, or 0 if it overlaps another or the heap, does not fit
+// below TRAPFRAME, or the table is full.
 static struct mmap_area*
-mmap_find_free_area(struct proc *p)
+mmap_insert(struct proc *p, uint64 addr, uint64 length)
+{
+  int i;
+
+  if(p->nmmap == MAX_MMAP_AREAS || addr < mmap_heaptop(p) ||
+     addr >= TRAPFRAME - MMAPBASE || length > TRAPFRAME - MMAPBASE - addr)
+    return 0;
+  i = mmap_index(p, addr);
+  if(i < p->nmmap && mmap_floor(&p->mmap_areas[i]) < addr + length)
+    return 0;
+  if(i > 0 && p->mmap_areas[i-1].addr + p->mmap_areas[i-1].length > addr)
+    return 0;
+
+  memmove(&p->mmap_areas[i+1], &p->mmap_areas[i],
+          (p->nmmap - i) * sizeof(struct mmap_area));
+  p->nmmap++;
+  p->mmap_hint = i;
+  return &p->mmap_areas[i];
+}
+
+// Remove area ma from p's table.
+static void
+mmap_remove(struct proc *p, struct mmap_area *ma)
 {
-  for (int i = 0; i < MMAP_MAX_AREAS; i++) {
-    if (!p->mmap_areas[i].used) {
-      return &p->mmap_areas[i];
+  int i = ma - p->mmap_areas;
+
+  memmove(ma, ma + 1, (p->nmmap - i - 1) * sizeof(struct mmap_area));
+  p->nmmap--;
+  p->mmap_hint = 0;
+}
+
+// Split area ma at offset at, which must lie strictly inside
+// it. ma keeps the lower part; the upper part follows it in
+// the table. Returns -1 if the table is full.
+static int
+mmap_split(struct proc *p, struct mmap_area *ma, uint64 at)
+{
+  int i = ma - p->mmap_areas;
+  struct mmap_area *hi = ma + 1;
+
+  if(p->nmmap == MAX_MMAP_AREAS)
+    return -1;
+  memmove(hi, ma, (p->nmmap - i) * sizeof(struct mmap_area));
+  p->nmmap++;
+
+  hi->addr = at;
+  hi->length = ma->addr + ma->length - at;
+  hi->offset = ma->offset + (at - ma->addr);
+  hi->ra_next = hi->ra_win = 0;
+  ma->length = at - ma->addr;
+  if(ma->f)
+    filedup(ma->f);
+  return 0;
+}
+
+// Merge neighbouring areas of p that map adjacent parts of
+// the same thing in the same way, undoing earlier splits.
+static void
+mmap_merge(struct proc *p)
+{
+  for(int i = 0; i + 1 < p->nmmap; ){
+    struct mmap_area *a = &p->mmap_areas[i], *b = a + 1;
+    if(a->addr + a->length == b->addr && a->f == b->f &&
+       a->prot == b->prot && a->flags == b->flags && a->advice == b->advice &&
+       a->merge == b->merge &&
+       (a->f == 0 || a->offset + a->length == b->offset)){
+      a->length += b->length;
+      // a still holds the file, so this is not the last reference.
+      if(b->f)
+        fileclose(b->f);
+      mmap_remove(p, b);
+    } else {
+      i++;
     }
   }
-  return 0;
+}
+
+// Split p's areas so that none straddles offset at, first
+// breaking up a megapage that does. The megapage is split even
+// when an area already ends at at, since madvise() hints split
+// areas but leave their megapages whole.
+// Returns -1 if out of memory.
+static int
+mmap_cut(struct proc *p, uint64 at)
+{
+  struct mmap_area *ma = mmap_lookup(p, MMAPBASE + at);
+
+  if(uvmsplitmega(p->pagetable, MMAPBASE + at) < 0)
+    return -1;
+  if(ma == 0 || ma->addr == at)
+    return 0;
+  return mmap_split(p, ma, at);
 }
 
 static int
@@ -1021,24 +1385,29 @@ mmap_populate(struct proc *p, struct mmap_area *ma)
 {
   uint64 base = MMAPBASE + ma->addr;
   int off;
+  int perm = PTE_U | PTE_R;
+  if (ma->prot & PROT_WRITE) perm |= PTE_W;
 
   for (off = 0; off < ma->length; off += PGSIZE) {
-    char *mem = kalloc();
-    if (!mem) goto fail;
-    memset(mem, 0, PGSIZE);
-
-    if (ma->f) {
-      ilock(ma->f->ip);
-      int rn = readi(ma->f->ip, mem, ma->offset + off, PGSIZE);
-      iunlock(ma->f->ip);
-      if (rn < 0) { kfree(mem); goto fail; }
-      // rn < PGSIZE 이면 나머지는 0으로 둔다.
+    // MAP_HUGE: 정렬된 2MB 구간은 megapage로, 실패하면 4KB로 채운다
+    if ((ma->flags & MAP_HUGE) && (base + off) % MEGAPGSIZE == 0 &&
+        off + MEGAPGSIZE <= ma->length &&
+        uvmmega(p->pagetable, base + off, perm) == 0) {
+      off += MEGAPGSIZE - PGSIZE;
+      continue;
     }
 
-    int perm = PTE_U | PTE_R;
-    if (ma->prot & PROT_WRITE) perm |= PTE_W;
+    // RSS 제한(setrlimit)에 닿으면 실패
+    if (p->rss >= p->rsslimit) goto fail;
+    char *mem = ma->f ? mmap_filepage(ma, off) : kalloc_zeroed();
+    if (!mem) goto fail;
 
-    if (mappages(p->pagetable, base + off, PGSIZE, (uint64)mem, perm) < 0) {
+    // MAP_PRIVATE 파일 매핑은 cache 페이지를 COW로 공유
+    int pteperm = perm;
+    if (ma->f && (perm & PTE_W) && !(ma->flags & MAP_SHARED))
+      pteperm = (perm & ~PTE_W) | PTE_COW;
+
+    if (mappages(p->pagetable, base + off, PGSIZE, (uint64)mem, pteperm) < 0) {
       kfree(mem);
       goto fail;
     }
@@ -1060,7 +1429,10 @@ uint64 mmap(uint64 addr, int length, int prot, int flags, int fd, int offset){
   if(addr != 0 && (addr % PGSIZE) != 0) return 0;
   if((offset % PGSIZE) != 0) return 0;
   if(prot & ~(PROT_READ | PROT_WRITE)) return 0;
-  if(flags & ~(MAP_ANONYMOUS | MAP_POPULATE)) return 0;
+  if(flags & ~(MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGE | MAP_SHARED | MAP_PRIVATE)) return 0;
+  if((flags & MAP_SHARED) && (flags & MAP_PRIVATE)) return 0;
+  if((flags & MAP_HUGE) && !(flags & MAP_ANONYMOUS)) return 0;
+  if((flags & MAP_SHARED) && (flags & MAP_ANONYMOUS)) return 0;
 // 인자 검사 직후
   if (flags & MAP_ANONYMOUS) {
     if (fd != -1 || offset != 0) return 0;
@@ -1070,19 +1442,19 @@ uint64 mmap(uint64 addr, int length, int prot, int flags, int fd, int offset){
     f = myproc()->ofile[fd];
     if (!f) return 0;
     if ((prot & PROT_READ)  && !f->readable) return 0;
+    if (f->type != FD_INODE) return 0;
     if ((prot & PROT_WRITE) && !f->writable) return 0;
-    // 필요시 filedup(f);
   }
 
   acquire(&p->lock);
   if(addr==0){
-    uint64 cur = PGROUNDUP(p->mmap_cursor);
-    addr = cur;
-    if (addr + length < addr) { release(&p->lock); return 0; }
-    p->mmap_cursor = addr+length;
+    // 비어 있는 가장 낮은 구간을 찾는다.
+    // MAP_HUGE 영역은 megapage를 쓸 수 있도록 2MB 경계에서 시작
+    addr = mmap_findgap(p, length, (flags & MAP_HUGE) ? MEGAPGSIZE : PGSIZE);
+    if (addr == -1) { release(&p->lock); return 0; }
   }
-  // 3) mmap_area 예약 (used=1)
-  ma = mmap_find_free_area(p);
+  // 3) mmap_area 예약 (used=1), 다른 영역과 겹치면 실패
+  ma = mmap_insert(p, addr, length);
   if(!ma)
   {
       release(&p->lock);
@@ -1099,14 +1471,22 @@ uint64 mmap(uint64 addr, int length, int prot, int flags, int fd, int offset){
   ma->flags = flags;
   ma->p = p;
   ma->populated = 0;
+  ma->ra_next = 0;
+  ma->ra_win = 0;
+  ma->advice = MADV_NORMAL;
+  ma->merge = 0;
 
   release(&p->lock);
 
+  // fd가 닫혀도 매핑이 파일을 쓸 수 있도록 참조를 잡는다
+  if (f) filedup(f);
+
 if (flags & MAP_POPULATE) {
   if (mmap_populate(p, ma) == 0) {       // 실패
     acquire(&p->lock);
-    ma->used = 0;
+    mmap_remove(p, ma);
     release(&p->lock);
+    if (f) fileclose(f);
     return 0;
   }
   acquire(&p->lock);
@@ -1118,16 +1498,622 @@ if (flags & MAP_POPULATE) {
   return (MMAPBASE + ma->addr);
 }
 
+// Give p, which has no mmap areas yet, its stack: an anonymous
+// area of USTACKMAX bytes below USTACKTOP. Like those of any
+// anonymous area, its pages are allocated as faults touch them,
+// so the stack grows as deep as it is used. For exec.
+void
+mmap_stack(struct proc *p)
+{
+  struct mmap_area *ma;
+
+  acquire(&p->lock);
+  if((ma = mmap_insert(p, USTACKTOP - USTACKMAX - MMAPBASE, USTACKMAX)) == 0)
+    panic("mmap_stack");
+  memset(ma, 0, sizeof(*ma));
+  ma->used = 1;
+  ma->addr = USTACKTOP - USTACKMAX - MMAPBASE;
+  ma->length = USTACKMAX;
+  ma->prot = PROT_READ | PROT_WRITE;
+  ma->flags = MAP_ANONYMOUS | MAP_STACK;
+  ma->p = p;
+  ma->advice = MADV_NORMAL;
+  release(&p->lock);
+}
+
+// Is ma a writable MAP_SHARED file mapping, whose pages
+// may need writing back?
+static int
+mmap_isshared(struct mmap_area *ma)
+{
+  return ma->used && ma->f && (ma->flags & MAP_SHARED) && (ma->prot & PROT_WRITE);
+}
+
+// Move the PTE dirty bits of shared mapping ma in pagetable
+// to the page cache, where pcflush() will find them.
+// Only the owning process may do this: its hart flushes the
+// TLB before returning to user space, so no stale TLB entry
+// can keep later writes from setting PTE_D again.
+static void
+mmap_collect(pagetable_t pagetable, struct mmap_area *ma)
+{
+  struct inode *ip = ma->f->ip;
+  uint64 base = MMAPBASE + ma->addr;
+  int dirty = 0;
+
+  ilock(ip);
+  for(uint64 off = 0; off < ma->length; off += PGSIZE){
+    pte_t *pte = walk(pagetable, base + off, 0);
+    if(pte && (*pte & PTE_V) && (*pte & PTE_D)){
+      *pte &= ~PTE_D;
+      pcmarkdirty(ip, (ma->offset + off) / PGSIZE);
+      dirty = 1;
+    }
+  }
+  iunlock(ip);
+  if(dirty)
+    sfence_vma();
+}
+
+// Collect the dirty bits of all of p's shared mappings.
+// Called from usertrap() every WBTICKS timer ticks, so that
+// pcflushd can write the pages back in the background.
+void
+mmap_collectall(struct proc *p)
+{
+  for(int i = 0; i < p->nmmap; i++){
+    if(mmap_isshared(&p->mmap_areas[i]))
+      mmap_collect(p->pagetable, &p->mmap_areas[i]);
+  }
+}
+
+// Write back the shared mappings of the current process that
+// overlap [addr, addr+length).
+// Returns 0 on success, -1 if the range is not page aligned.
+int
+msync(uint64 addr, int length)
+{
+  struct proc *p = myproc();
+
+  if((addr % PGSIZE) != 0 || length < 0)
+    return -1;
+  for(int i = 0; i < p->nmmap; i++){
+    struct mmap_area *ma = &p->mmap_areas[i];
+    uint64 start = MMAPBASE + ma->addr;
+    if(!mmap_isshared(ma) || start >= addr + length || start + ma->length <= addr)
+      continue;
+    mmap_collect(p->pagetable, ma);
+    pcflush(ma->f->ip);
+  }
+  return 0;
+}
+
+// Remove every mmap area of p from pagetable, free the pages
+// and release the mapped files, writing shared mappings back.
+// Used by exit and exec before the page table itself is freed.
+void
+mmap_unmapall(struct proc *p, pagetable_t pagetable)
+{
+  for(int i = 0; i < p->nmmap; i++){
+    struct mmap_area *ma = &p->mmap_areas[i];
+    if(mmap_isshared(ma)){
+      mmap_collect(pagetable, ma);
+      pcflush(ma->f->ip);
+    }
+    uvmunmap(pagetable, MMAPBASE + ma->addr, ma->length/PGSIZE, 1);
+    if(ma->f)
+      fileclose(ma->f);
+    ma->used = 0;
+  }
+  p->nmmap = 0;
+  p->mmap_hint = 0;
+}
+
+// Give np a copy of each of p's mmap areas, for fork.
+// MAP_SHARED mappings share their pages with the parent;
+// all other writable pages become copy-on-write.
+// Returns 0 on success, or -1 with nothing copied.
+// Does not sleep, since kfork() holds np->lock.
+static int
+mmap_copy(struct proc *p, struct proc *np)
+{
+  int i, j;
+
+  for(i = 0; i < p->nmmap; i++){
+    struct mmap_area *ma = &p->mmap_areas[i];
+    uint64 base = MMAPBASE + ma->addr;
+    if(uvmcopyrange(p->pagetable, np->pagetable, base, base + ma->length,
+                    (ma->flags & MAP_SHARED) != 0) < 0)
+      goto err;
+    np->mmap_areas[i] = *ma;
+    np->mmap_areas[i].p = np;
+    if(ma->f)
+      filedup(ma->f);
+  }
+  np->nmmap = p->nmmap;
+  return 0;
+
+ err:
+  // the parent still holds the files, so fileclose() won't sleep.
+  for(j = 0; j < i; j++){
+    struct mmap_area *ma = &np->mmap_areas[j];
+    uvmunmap(np->pagetable, MMAPBASE + ma->addr, ma->length/PGSIZE, 1);
+    if(ma->f)
+      fileclose(ma->f);
+  }
+  return -1;
+}
+
+// Check an mmap address range from user space and turn it
+// into offsets [*s, *e) from MMAPBASE.
+static int
+mmap_range(uint64 addr, int length, uint64 *s, uint64 *e)
+{
+  if((addr % PGSIZE) != 0 || length <= 0 || addr < MMAPBASE ||
+     addr + length > TRAPFRAME)
+    return -1;
+  *s = addr - MMAPBASE;
+  *e = *s + PGROUNDUP((uint64)length);
+  return 0;
+}
+
+// If p's areas cover all of [s, e), return the index of the
+// first one; otherwise return -1.
+static int
+mmap_covered(struct proc *p, uint64 s, uint64 e)
+{
+  int first = mmap_index(p, s + 1) - 1;
+  uint64 next = s;
+
+  for(int i = first; next < e; i++){
+    if(i < 0 || i >= p->nmmap)
+      return -1;
+    struct mmap_area *ma = &p->mmap_areas[i];
+    if(ma->addr > next || ma->addr + ma->length <= next)
+      return -1;
+    next = ma->addr + ma->length;
+  }
+  return first;
+}
+
+// Remove the mappings in [addr, addr+length), splitting areas
+// that reach outside it, and free their pages. Parts of the
+// range that are not mapped are ignored. All PTEs are removed
+// first and the TLB is flushed once at the end.
+// Returns 0 on success, -1 on a bad range or out of memory.
+int
+munmap(uint64 addr, int length)
+{
+  struct proc *p = myproc();
+  uint64 s, e;
+  int i;
+
+  if(mmap_range(addr, length, &s, &e) < 0)
+    return -1;
+
+  acquire(&p->lock);
+  if(mmap_cut(p, s) < 0 || mmap_cut(p, e) < 0){
+    release(&p->lock);
+    return -1;
+  }
+  release(&p->lock);
+
+  for(i = mmap_index(p, s); i < p->nmmap && p->mmap_areas[i].addr < e; ){
+    struct mmap_area *ma = &p->mmap_areas[i];
+    struct file *f = ma->f;
+    if(mmap_isshared(ma)){
+      mmap_collect(p->pagetable, ma);
+      pcflush(f->ip);
+    }
+    uvmunmap(p->pagetable, MMAPBASE + ma->addr, ma->length/PGSIZE, 1);
+    acquire(&p->lock);
+    mmap_remove(p, ma);
+    release(&p->lock);
+    if(f)
+      fileclose(f);
+  }
+  tlbshootdown(p);
+  return 0;
+}
+
+// Change the protection of the mapped pages in [addr, addr+length)
+// to prot, splitting and re-merging areas as needed.
+// Returns 0 on success, -1 if part of the range is not mapped,
+// if prot asks for more than a shared file allows, or if out
+// of memory.
+int
+mprotect(uint64 addr, int length, int prot)
+{
+  struct proc *p = myproc();
+  struct mmap_area *ma;
+  uint64 s, e;
+  int i;
+
+  if(mmap_range(addr, length, &s, &e) < 0 || (prot & ~(PROT_READ|PROT_WRITE)))
+    return -1;
+  if((i = mmap_covered(p, s, e)) < 0)
+    return -1;
+  for(; i < p->nmmap && p->mmap_areas[i].addr < e; i++){
+    ma = &p->mmap_areas[i];
+    if((prot & PROT_WRITE) && ma->f && (ma->flags & MAP_SHARED) && !ma->f->writable)
+      return -1;
+  }
+
+  acquire(&p->lock);
+  if(mmap_cut(p, s) < 0 || mmap_cut(p, e) < 0){
+    release(&p->lock);
+    return -1;
+  }
+  release(&p->lock);
+
+  for(i = mmap_index(p, s); i < p->nmmap && p->mmap_areas[i].addr < e; i++){
+    ma = &p->mmap_areas[i];
+    // write back while the dirty bits are still being tracked.
+    if(mmap_isshared(ma) && !(prot & PROT_WRITE)){
+      mmap_collect(p->pagetable, ma);
+      pcflush(ma->f->ip);
+    }
+    uvmprotect(p->pagetable, MMAPBASE + ma->addr, ma->length/PGSIZE, prot,
+               (ma->flags & MAP_SHARED) != 0);
+    ma->prot = prot;
+  }
+
+  acquire(&p->lock);
+  mmap_merge(p);
+  release(&p->lock);
+  tlbshootdown(p);
+  return 0;
+}
+
+// Resize the mapping [addr, addr+oldlen), which must lie in
+// one area, to newlen bytes. It shrinks by unmapping its tail
+// and grows in place if the addresses after it are free.
+// Otherwise, with MREMAP_MAYMOVE in flags, it moves to a gap
+// big enough for newlen: the PTEs move and the pages stay
+// where they are.
+// Returns the mapping's new address, or 0 on failure.
+uint64
+mremap(uint64 addr, int oldlen, int newlen, int flags)
+{
+  struct proc *p = myproc();
+  struct mmap_area *ma, save;
+  uint64 s, e, ne, to, limit;
+  int i;
 
+  if(newlen <= 0 || (flags & ~MREMAP_MAYMOVE) || mmap_range(addr, oldlen, &s, &e) < 0)
+    return 0;
+  ne = s + PGROUNDUP((uint64)newlen);
+  if((ma = mmap_lookup(p, addr)) == 0 || ma->addr + ma->length < e)
+    return 0;
+  if(ne <= e){
+    if(ne < e && munmap(MMAPBASE + ne, e - ne) < 0)
+      return 0;
+    return addr;
+  }
 
+  // make [s, e) an area of its own.
+  acquire(&p->lock);
+  if(mmap_cut(p, s) < 0 || mmap_cut(p, e) < 0)
+    goto fail;
+  i = mmap_index(p, s);
+  ma = &p->mmap_areas[i];
+  limit = i + 1 < p->nmmap ? mmap_floor(&p->mmap_areas[i+1]) : TRAPFRAME - MMAPBASE;
+  if(ne <= limit){
+    ma->length = ne - s;
+    mmap_merge(p);
+    release(&p->lock);
+    return addr;
+  }
 
+  if((flags & MREMAP_MAYMOVE) == 0)
+    goto fail;
+  to = mmap_findgap(p, ne - s, (ma->flags & MAP_HUGE) ? MEGAPGSIZE : PGSIZE);
+  if(to == -1 || uvmmove(p->pagetable, MMAPBASE + s, MMAPBASE + to, e - s) < 0)
+    goto fail;
+  save = *ma;
+  mmap_remove(p, ma);
+  // cannot fail: a slot was just freed and the gap is empty.
+  ma = mmap_insert(p, to, ne - s);
+  *ma = save;
+  ma->addr = to;
+  ma->length = ne - s;
+  ma->ra_next = ma->ra_win = 0;
+  mmap_merge(p);
+  release(&p->lock);
+  tlbshootdown(p);
+  return MMAPBASE + to;
 
+fail:
+  // put back together what the cuts split.
+  mmap_merge(p);
+  release(&p->lock);
+  return 0;
+}
 
+// Apply madvise() advice to [s, e), offsets from MMAPBASE,
+// which p's areas must cover.
+static int
+madvise_mmap(struct proc *p, uint64 s, uint64 e, int advice)
+{
+  struct mmap_area *ma;
+  uint64 a, b, va;
+  int i, first;
 
+  if((first = mmap_covered(p, s, e)) < 0)
+    return -1;
 
+  if(advice == MADV_MERGEABLE){
+    // file pages are already shared through the page cache.
+    for(i = first; i < p->nmmap && p->mmap_areas[i].addr < e; i++)
+      if(p->mmap_areas[i].f || (p->mmap_areas[i].flags & MAP_SHARED))
+        return -1;
+  }
 
+  if(advice == MADV_NORMAL || advice == MADV_RANDOM || advice == MADV_SEQUENTIAL ||
+     advice == MADV_MERGEABLE || advice == MADV_UNMERGEABLE){
+    // a hint, so split the areas but not their megapages.
+    acquire(&p->lock);
+    if(((ma = mmap_lookup(p, MMAPBASE + s)) && ma->addr != s && mmap_split(p, ma, s) < 0) ||
+       ((ma = mmap_lookup(p, MMAPBASE + e)) && ma->addr != e && mmap_split(p, ma, e) < 0)){
+      release(&p->lock);
+      return -1;
+    }
+    for(i = mmap_index(p, s); i < p->nmmap && p->mmap_areas[i].addr < e; i++){
+      ma = &p->mmap_areas[i];
+      if(advice == MADV_MERGEABLE || advice == MADV_UNMERGEABLE){
+        ma->merge = advice == MADV_MERGEABLE;
+        continue;
+      }
+      ma->advice = advice;
+      ma->ra_next = ma->ra_win = 0;
+    }
+    mmap_merge(p);
+    release(&p->lock);
+    return 0;
+  }
 
+  if(advice == MADV_FREE){
+    // only anonymous memory can be dropped without saving it.
+    for(i = first; i < p->nmmap && p->mmap_areas[i].addr < e; i++)
+      if(p->mmap_areas[i].f)
+        return -1;
+  }
+  if(advice == MADV_DONTNEED &&
+     (uvmsplitmega(p->pagetable, MMAPBASE + s) < 0 ||
+      uvmsplitmega(p->pagetable, MMAPBASE + e) < 0))
+    return -1;
 
+  for(i = first; i < p->nmmap && p->mmap_areas[i].addr < e; i++){
+    ma = &p->mmap_areas[i];
+    a = ma->addr > s ? ma->addr : s;
+    b = ma->addr + ma->length < e ? ma->addr + ma->length : e;
+    switch(advice){
+    case MADV_WILLNEED:
+      // fault the pages in, anonymous ones writable as by
+      // MAP_POPULATE; file faults also start readahead.
+      // pages in swap are read back.
+      for(va = MMAPBASE + a; va < MMAPBASE + b && p->rss < p->rsslimit; va += PGSIZE){
+        if(swapin(p->pagetable, va, 0) < 0)
+          break;
+        if(ismapped(p->pagetable, va))
+          continue;
+        if(handle_mmap_pgfault(p, va, !ma->f && (ma->prot & PROT_WRITE)) != 1)
+          break;
+      }
+      break;
+    case MADV_DONTNEED:
+      // file pages come back from the page cache, anonymous
+      // ones as zeros.
+      if(mmap_isshared(ma))
+        mmap_collect(p->pagetable, ma);
+      uvmunmap(p->pagetable, MMAPBASE + a, (b - a)/PGSIZE, 1);
+      ma->ra_next = ma->ra_win = 0;
+      break;
+    case MADV_FREE:
+      p->nlazy += uvmlazyfree(p->pagetable, MMAPBASE + a, (b - a)/PGSIZE);
+      break;
+    }
+  }
+  return 0;
+}
 
+// Apply madvise() advice to [va, end) of p's heap.
+static int
+madvise_heap(struct proc *p, uint64 va, uint64 end, int advice)
+{
+  pte_t *pte;
+  int r;
+
+  switch(advice){
+  case MADV_WILLNEED:
+    for(; va < end && p->rss < p->rsslimit; va += PGSIZE){
+      if(swapin(p->pagetable, va, 0) < 0)
+        break;
+      if(ismapped(p->pagetable, va))
+        continue;
+      if((r = execfault(p, va, 0)) < 0 || (r == 0 && vmfault(p->pagetable, va, 0) == 0))
+        break;
+    }
+    break;
+  case MADV_DONTNEED:
+    // vmfault() maps zeros again on the next touch, and
+    // execfault() the executable's pages. Pages without
+    // PTE_U stay.
+    for(; va < end; va += PGSIZE){
+      pte = walk(p->pagetable, va, 0);
+      if(pte && (*pte & (PTE_V|PTE_SWAP)) && (*pte & PTE_U))
+        uvmunmap(p->pagetable, va, 1, 1);
+    }
+    break;
+  case MADV_FREE:
+    p->nlazy += uvmlazyfree(p->pagetable, va, (end - va)/PGSIZE);
+    break;
+  }
+  // the heap has no readahead to tune.
+  return 0;
+}
 
+// Take advice on how the current process will use the memory
+// in [addr, addr+length), either mmap areas, which must cover
+// it, or the heap below p->sz:
+//   MADV_WILLNEED: map the pages now.
+//   MADV_DONTNEED: free the pages now; the memory stays
+//     allocated and reads back as zeros (anonymous) or the
+//     file's contents.
+//   MADV_FREE: like MADV_DONTNEED for anonymous memory, but
+//     only once free memory runs low, and only for pages not
+//     written in the meantime (see lazyreclaim()).
+//   MADV_SEQUENTIAL, MADV_RANDOM, MADV_NORMAL: readahead for
+//     file areas.
+//   MADV_MERGEABLE: let ksmd share identical pages of private
+//     anonymous areas read-only (see ksm.c); MADV_UNMERGEABLE
+//     stops that, and pages already shared stay so until
+//     written.
+// Returns 0 on success, -1 on a bad range or advice, or if
+// out of memory.
+int
+madvise(uint64 addr, int length, int advice)
+{
+  struct proc *p = myproc();
+  uint64 s, e;
+  int r;
 
+  if(advice != MADV_NORMAL && advice != MADV_RANDOM && advice != MADV_SEQUENTIAL &&
+     advice != MADV_WILLNEED && advice != MADV_DONTNEED && advice != MADV_FREE &&
+     advice != MADV_MERGEABLE && advice != MADV_UNMERGEABLE)
+    return -1;
+  if(addr >= MMAPBASE){
+    if(mmap_range(addr, length, &s, &e) < 0)
+      return -1;
+    r = madvise_mmap(p, s, e, advice);
+  } else {
+    if((addr % PGSIZE) != 0 || length <= 0 || addr + length > PGROUNDUP(p->sz) ||
+       advice == MADV_MERGEABLE || advice == MADV_UNMERGEABLE)
+      return -1;
+    r = madvise_heap(p, addr, addr + PGROUNDUP((uint64)length), advice);
+  }
+  // the PTEs lost pages or dirty bits.
+  if(advice == MADV_DONTNEED || advice == MADV_FREE)
+    tlbshootdown(p);
+  return r;
+}
+
+// Free p's pages that were given up with MADV_FREE and not
+// written since. Called from usertrap() when free memory runs
+// low, by p itself, so no other hart can be writing them.
+void
+lazyreclaim(struct proc *p)
+{
+  int n;
+
+  n = uvmreclaim(p->pagetable, 0, PGROUNDUP(p->sz)/PGSIZE);
+  for(int i = 0; i < p->nmmap; i++){
+    struct mmap_area *ma = &p->mmap_areas[i];
+    if(ma->f == 0)
+      n += uvmreclaim(p->pagetable, MMAPBASE + ma->addr, ma->length/PGSIZE);
+  }
+  p->nlazy = 0;
+  if(n > 0)
+    tlbshootdown(p);
+}
+
+// ASIDs tag each process's TLB entries, so that they survive
+// traps into the kernel (which uses ASID 0) and switches to
+// other processes. They are handed out in order; when they run
+// out a new generation begins, and every process gets a new
+// ASID the next time it returns to user space. p->asid holds
+// the generation above the ASID bits, so 0 is never current.
+// A hart flushes its whole TLB before it first uses an ASID of
+// a new generation, since ASIDs are reused across generations.
+struct {
+  struct spinlock lock;
+  uint64 gen;      // current generation
+  uint64 next;     // next unused ASID of this generation
+  uint64 n;        // ASIDs the hardware implements
+} asids;
+
+#define ASIDGEN(asid) ((asid) >> 16)   // above SATP_ASID_MASK
+
+// Find out how many ASIDs the hardware implements: the
+// unimplemented high bits of the satp ASID field read as zero.
+static void
+asidinit(void)
+{
+  uint64 satp = r_satp();
+
+  initlock(&asids.lock, "asids");
+  w_satp(satp | (SATP_ASID_MASK << SATP_ASID_SHIFT));
+  asids.n = ((r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK) + 1;
+  w_satp(satp);
+  sfence_vma();
+  asids.gen = 1;
+  asids.next = 1;
+}
+
+// Return the satp with which p returns to user space, giving p
+// an ASID of the current generation if it lacks one. Also
+// flushes p's ASID from this hart's TLB if p last ran on
+// another hart, since changes to p's page table made there
+// flushed only that hart's TLB (see tlbshootdown()). Without
+// ASIDs every process uses ASID 0 and the trampoline flushes
+// the TLB on each switch. Called with interrupts off.
+uint64
+procsatp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 asid;
+
+  if(asids.n < 2)
+    return MAKE_SATP(p->pagetable);
+
+  acquire(&asids.lock);
+  if(ASIDGEN(p->asid) != asids.gen){
+    if(asids.next == asids.n){
+      asids.gen++;
+      asids.next = 1;
+    }
+    // no hart has used it in this generation.
+    p->asid = (asids.gen << 16) | asids.next++;
+    p->asidcpu = cpuid();
+  }
+  if(c->asidgen != asids.gen){
+    c->asidgen = asids.gen;
+    sfence_vma();
+    p->asidcpu = cpuid();
+  }
+  release(&asids.lock);
+
+  asid = p->asid & SATP_ASID_MASK;
+  if(p->asidcpu != cpuid()){
+    sfence_vma_asid(asid);
+    p->asidcpu = cpuid();
+  }
+  return MAKE_SATP_ASID(p->pagetable, asid);
+}
+
+// Make stale translations of p's user memory go away after
+// its PTEs were removed, changed or lost permissions. Callers
+// batch all the PTE changes of an operation and then call this
+// once. For the current process, flush its ASID from this
+// hart's TLB; any other hart that ran it flushes before it
+// runs it again (see procsatp()). Another process must not be
+// running, and the caller must hold its lock; it will flush
+// wherever it runs next.
+void
+tlbshootdown(struct proc *p)
+{
+  if(p != myproc()){
+    p->asidcpu = -1;
+    return;
+  }
+  push_off();
+  sfence_vma_asid(p->asid & SATP_ASID_MASK);
+  pop_off();
+}
+
+// Number of free physical pages.
+int
+freemem(void)
+{
+  return countfree();
+}
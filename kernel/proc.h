@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this hart's TLB was flushed for.
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +80,32 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A loadable segment of a process's executable, which exec
+// leaves to execfault() to page in on demand.
+struct execseg {
+  uint64 va;       // page-aligned start
+  uint64 filesz;   // bytes from the file
+  uint64 memsz;    // bytes in memory; those after filesz are zero
+  uint off;        // page-aligned file offset of the first byte
+  int perm;        // PTE_X and PTE_W
+};
+
+struct mmap_area{
+    struct file *f;
+    uint64 addr;
+    int length;
+    int offset;
+    int prot;
+    int flags;
+    struct proc* p;
+    int used;
+    int populated;
+    uint64 ra_next;   // 다음 순차 폴트가 예상되는 영역 내 오프셋
+    int ra_win;       // 현재 readahead 창 크기(페이지)
+    int advice;       // madvise()의 MADV_NORMAL, MADV_RANDOM, MADV_SEQUENTIAL
+    int merge;        // MADV_MERGEABLE: ksmd가 같은 내용의 페이지를 합친다
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -95,7 +122,19 @@ struct proc {
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
   
-  struct mmap_area *mmap_areas[MMAP_MAX_AREAS];
+  struct mmap_area mmap_areas[MAX_MMAP_AREAS]; // sorted by addr
+  int nmmap;                   // mmap_areas[0..nmmap) are in use
+  int mmap_hint;               // index of the last area looked up
+  int nlazy;                   // pages marked by MADV_FREE since the last lazyreclaim()
+  uint64 asid;                 // generation and ASID; see procsatp()
+  int asidcpu;                 // hart that last ran p with asid, or -1
+  uint64 swapva;               // where kswapd's clock stands in p's memory
+  uint64 ksmva;                // where ksmd's scan stands in p's memory
+  int oomadj;                  // added to p's badness for the oom killer, see oom.c
+  int rss;                     // resident user pages; see vmaccount()
+  int mmpages;                 // resident pages of mmap areas, part of rss
+  int ptpages;                 // page-table pages
+  uint64 rsslimit;             // most resident pages; see setrlimit()
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
@@ -105,6 +144,9 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // executable that segs[] page in from, or 0
+  struct execseg segs[NEXECSEG];
+  int nseg;                    // segs[0..nseg) are in use
   char name[16];               // Process name (debu
   int nice;
   uint64 vruntime;
@@ -112,25 +154,9 @@ struct proc {
   uint64 runtime;
   uint weight;
   int timeslice;
-  uint64 mmap_cursor;
-};
-
-struct mmap_area{
-    struct file *f;
-    uint64 addr;
-    int length;
-    int offset;
-    int prot;
-    int flags;
-    struct proc* p;
-    int used;
-    int populated;
+  int wbticks;                 // timer ticks since shared mappings were collected
 };
 
-struct{
-    struct spinlock lock;
-    struct mmap_area areas[MAX_MMAP_AREAS];
-} mmap_manager;
 
 
 #define WEIGHT_NICE_20 1024
@@ -10,6 +10,10 @@ void timerinit();
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
+// does hart i implement the vector extension?
+// string.c uses the vector routines only if so.
+char hart_rvv[NCPU];
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -44,6 +48,12 @@ start()
   int id = r_mhartid();
   w_tp(id);
 
+  // turn on the vector unit for supervisor mode, if there is one.
+  if(r_misa() & MISA_V){
+    w_mstatus(r_mstatus() | MSTATUS_VS_INITIAL);
+    hart_rvv[id] = 1;
+  }
+
   // switch to supervisor mode and jump to main().
   asm volatile("mret");
 }
@@ -58,8 +68,8 @@ timerinit()
   // enable the sstc extension (i.e. stimecmp).
   w_menvcfg(r_menvcfg() | (1L << 63)); 
   
-  // allow supervisor to use stimecmp and time.
-  w_mcounteren(r_mcounteren() | 2);
+  // allow supervisor to use stimecmp, time and cycle.
+  w_mcounteren(r_mcounteren() | 2 | 1);
   
   // ask for the very first timer interrupt.
   w_stimecmp(r_time() + 1000000);
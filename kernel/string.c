@@ -1,23 +1,70 @@
 #include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
 
-void*
-memset(void *dst, int c, uint n)
+// mem* routines move 64-bit words, eight to a loop iteration,
+// once both pointers are 8-byte aligned. on harts with the
+// vector extension, large requests go to the RVV loops in
+// vecmem.S instead.
+
+// requests at least this large use the vector loops.
+#define VECMIN 256
+
+extern char hart_rvv[NCPU];   // start.c: does hart implement V?
+
+void vmemset(void*, int, uint64);
+void vmemcpy(void*, const void*, uint64);
+int vmemcmp(const void*, const void*, uint64);
+
+static void*
+wmemset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 *wdst, w;
+
+  while(n > 0 && ((uint64)cdst & 7) != 0){
+    *cdst++ = c;
+    n--;
   }
+
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wdst = (uint64 *) cdst;
+  for(; n >= 64; n -= 64, wdst += 8){
+    wdst[0] = w; wdst[1] = w; wdst[2] = w; wdst[3] = w;
+    wdst[4] = w; wdst[5] = w; wdst[6] = w; wdst[7] = w;
+  }
+  for(; n >= 8; n -= 8)
+    *wdst++ = w;
+
+  cdst = (char *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
-int
-memcmp(const void *v1, const void *v2, uint n)
+static int
+wmemcmp(const void *v1, const void *v2, uint n)
 {
   const uchar *s1, *s2;
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & 7) == 0){
+    while(n > 0 && ((uint64)s1 & 7) != 0){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip equal words; the byte loop below finds
+    // the first difference inside an unequal word.
+    while(n >= 8 && *(uint64*)s1 == *(uint64*)s2){
+      s1 += 8, s2 += 8, n -= 8;
+    }
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -27,11 +74,13 @@ memcmp(const void *v1, const void *v2, uint n)
   return 0;
 }
 
-void*
-memmove(void *dst, const void *src, uint n)
+static void*
+wmemmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  const uint64 *ws;
+  uint64 *wd;
 
   if(n == 0)
     return dst;
@@ -41,15 +90,101 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if((((uint64)s ^ (uint64)d) & 7) == 0){
+      while(n > 0 && ((uint64)d & 7) != 0){
+        *--d = *--s;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 64; n -= 64){
+        ws -= 8, wd -= 8;
+        wd[7] = ws[7]; wd[6] = ws[6]; wd[5] = ws[5]; wd[4] = ws[4];
+        wd[3] = ws[3]; wd[2] = ws[2]; wd[1] = ws[1]; wd[0] = ws[0];
+      }
+      for(; n >= 8; n -= 8)
+        *--wd = *--ws;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if((((uint64)s ^ (uint64)d) & 7) == 0){
+      while(n > 0 && ((uint64)d & 7) != 0){
+        *d++ = *s++;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 64; n -= 64, ws += 8, wd += 8){
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= 8; n -= 8)
+        *wd++ = *ws++;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
 
+// If this hart has the vector extension, return 1
+// with interrupts off; the caller must pop_off() after
+// the vector routine returns. Otherwise return 0.
+static int
+vecbegin(uint n)
+{
+  if(n < VECMIN)
+    return 0;
+  push_off();
+  if(hart_rvv[cpuid()])
+    return 1;
+  pop_off();
+  return 0;
+}
+
+void*
+memset(void *dst, int c, uint n)
+{
+  if(vecbegin(n)){
+    vmemset(dst, c, n);
+    pop_off();
+    return dst;
+  }
+  return wmemset(dst, c, n);
+}
+
+int
+memcmp(const void *v1, const void *v2, uint n)
+{
+  int r;
+
+  if(vecbegin(n)){
+    r = vmemcmp(v1, v2, n);
+    pop_off();
+    return r;
+  }
+  return wmemcmp(v1, v2, n);
+}
+
+void*
+memmove(void *dst, const void *src, uint n)
+{
+  // the vector loop copies forward in strips, which is
+  // only safe if dst does not overlap the tail of src.
+  if(((char*)dst <= (char*)src || (char*)dst >= (char*)src + n) && vecbegin(n)){
+    vmemcpy(dst, src, n);
+    pop_off();
+    return dst;
+  }
+  return wmemmove(dst, src, n);
+}
+
 // memcpy exists to placate GCC.  Use memmove.
 void*
 memcpy(void *dst, const void *src, uint n)
@@ -57,6 +192,63 @@ memcpy(void *dst, const void *src, uint n)
   return memmove(dst, src, n);
 }
 
+// Print the throughput of the word and (if this hart has V)
+// vector implementations, in bytes per cycle, for a few
+// sizes of cache-resident buffers.
+void
+membench(void)
+{
+  static uint sizes[] = { 64, 512, 4096 };
+  char *a, *b;
+  int vec;
+
+  if((a = kalloc()) == 0 || (b = kalloc()) == 0)
+    panic("membench");
+  push_off();
+  vec = hart_rvv[cpuid()];
+  pop_off();
+
+  printf("membench: bytes/cycle (hart %s V)\n", vec ? "has" : "lacks");
+  printf("size\tmemset\tmemmove\tmemcmp\timpl\n");
+  for(int impl = 0; impl < 1 + vec; impl++){
+    for(int i = 0; i < NELEM(sizes); i++){
+      uint n = sizes[i];
+      int iters = (1 << 20) / n;
+      uint64 c[3];
+
+      // interrupts off keeps timer work out of the counts,
+      // and is required around the vector routines.
+      push_off();
+      uint64 t = r_cycle();
+      for(int k = 0; k < iters; k++){
+        if(impl) vmemset(a, k, n); else wmemset(a, k, n);
+      }
+      c[0] = r_cycle() - t;
+      t = r_cycle();
+      for(int k = 0; k < iters; k++){
+        if(impl) vmemcpy(b, a, n); else wmemmove(b, a, n);
+      }
+      c[1] = r_cycle() - t;
+      t = r_cycle();
+      for(int k = 0; k < iters; k++){
+        if(impl) vmemcmp(a, b, n); else wmemcmp(a, b, n);
+      }
+      c[2] = r_cycle() - t;
+      pop_off();
+
+      printf("%d", n);
+      for(int j = 0; j < 3; j++){
+        uint64 x = c[j] ? ((uint64)n * iters * 100) / c[j] : 0;
+        printf("\t%lu.%lu%lu", x / 100, (x / 10) % 10, x % 10);
+      }
+      printf("\t%s\n", impl ? "rvv" : "word");
+    }
+  }
+
+  kfree(a);
+  kfree(b);
+}
+
 int
 strncmp(const char *p, const char *q, uint n)
 {
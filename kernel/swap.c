@@ -0,0 +1,391 @@
+// Swap: when free memory runs low, kswapd pages anonymous user
+// memory out to the swap area, NSWAP page-sized slots on the
+// disk right after the file system.
+//
+// kswapd runs a clock over the user pages of every process.
+// A page whose PTE_A is set has been used since the clock last
+// passed it and gets a second chance: PTE_A is cleared. Any other
+// page that only its process maps is written to a swap slot, and
+// its PTE is replaced by one with PTE_SWAP instead of PTE_V that
+// keeps the slot number, so that the next access faults and
+// swapin() reads the page back. fork() shares a page in swap by
+// its slot, so slots are reference counted.
+//
+// Pages go to the compressed pool in memory first (see zswap.c);
+// kswapd writes the others, up to SWAPBATCH pages to consecutive
+// slots with one disk request. It changes another process's page table only
+// while it holds the process's lock and the process is not
+// running, and it releases the lock for the disk write; so after
+// the write it checks that the page is still mapped the same way
+// and was not used or written meanwhile. The kernel marks pages
+// it copies to or from as used too (see upa() in vm.c).
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "defs.h"
+
+extern struct proc proc[NPROC];
+
+// first disk sector of swap slot s.
+#define SLOT2SECTOR(s) (((uint64)FSSIZE*BSIZE + (uint64)(s)*PGSIZE) / 512)
+
+struct {
+  struct spinlock lock;
+  uchar ref[NSWAP];  // PTEs holding each slot
+  int next;          // where swapalloc() looks first
+
+  // written only by kswapd.
+  int hand;          // the clock hand, an index in proc[]
+  int sweeps;        // sweeps done, see kswapd()
+  int stuck;         // the last sweep freed nothing
+} swap;
+
+// a page that kswapd is paging out.
+struct victim {
+  uint64 va;
+  char *pa;
+  int slot;
+};
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+}
+
+// Allocate up to n consecutive free slots. Sets *slot to the
+// first and returns how many, or 0 if swap is full.
+static int
+swapalloc(int n, int *slot)
+{
+  int i, k, s = 0;
+
+  acquire(&swap.lock);
+  for(i = 0; i < NSWAP; i++){
+    s = (swap.next + i) % NSWAP;
+    if(swap.ref[s] == 0)
+      break;
+  }
+  k = 0;
+  if(i < NSWAP){
+    for(; k < n && s + k < NSWAP && swap.ref[s + k] == 0; k++)
+      swap.ref[s + k] = 1;
+    swap.next = (s + k) % NSWAP;
+    *slot = s;
+  }
+  release(&swap.lock);
+  return k;
+}
+
+// Another PTE holds slot.
+void
+swapdup(int slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// A PTE no longer holds slot.
+void
+swapfree(int slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapfree");
+  // before swapalloc() can hand the slot out again.
+  if(--swap.ref[slot] == 0)
+    zswap_drop(slot);
+  release(&swap.lock);
+}
+
+// Read or write the n pages at pages[] from or to the swap
+// slots starting at slot, with one disk request.
+void
+swapio(int slot, char **pages, int n, int write)
+{
+  virtio_disk_rwpages(SLOT2SECTOR(slot), pages, n, write);
+}
+
+// Number of PTEs holding slot.
+int
+swapcount(int slot)
+{
+  int n;
+
+  acquire(&swap.lock);
+  n = swap.ref[slot];
+  release(&swap.lock);
+  return n;
+}
+
+// If user page va of pagetable is in swap, read it back into a
+// new page. Returns 1 if it was in swap and its PTE allows the
+// access (write says which); 0 if it was not in swap, or if its
+// PTE does not allow the access, which the caller should then
+// handle as if the page had never been in swap; or -1 if out of
+// memory. May sleep.
+int
+swapin(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte, old;
+  char *mem;
+
+  if(va >= MAXVA)
+    return 0;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) == 0 || (*pte & PTE_SWAP) == 0)
+    return 0;
+  if((mem = kalloc()) == 0)
+    return -1;
+
+  // only the process itself changes a PTE in swap, and it is
+  // waiting here.
+  old = *pte;
+  if(zswap_load(PTE2SLOT(old), mem) == 0)
+    swapio(PTE2SLOT(old), &mem, 1, 0);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_V;
+  swapfree(PTE2SLOT(old));
+  vmaccount(pagetable, va, 1, 0);
+
+  if((*pte & PTE_U) == 0 || (write && (*pte & PTE_W) == 0))
+    return 0;
+  return 1;
+}
+
+// The start of the next part of p's memory at or after va that
+// kswapd may page out, the heap and private anonymous mmap
+// areas, or MAXVA if there is none. Sets *end to its end.
+static uint64
+swapregion(struct proc *p, uint64 va, uint64 *end)
+{
+  struct mmap_area *ma;
+  uint64 s, e;
+
+  if(va < p->sz){
+    *end = PGROUNDUP(p->sz);
+    return va;
+  }
+  for(int i = 0; i < p->nmmap; i++){
+    ma = &p->mmap_areas[i];
+    s = MMAPBASE + ma->addr;
+    e = s + ma->length;
+    if(ma->f || (ma->flags & MAP_SHARED) || e <= va)
+      continue;
+    *end = e;
+    return va > s ? va : s;
+  }
+  return MAXVA;
+}
+
+// Move p's clock hand over up to SWAPSCAN PTEs. Pages used since
+// the last pass lose PTE_A; lazily freed ones (MADV_FREE) that
+// were not written since are freed; the others are taken as
+// victims, up to SWAPBATCH of them, with their dirty bits
+// cleared and a reference each, so they cannot be freed while
+// kswapd writes them. Sets *nv to the number of victims and
+// *freed to the number of pages freed. Returns 1 if the hand
+// reached the end of p's memory, else 0. The caller holds p->lock.
+static int
+swapclock(struct proc *p, struct victim *v, int *nv, int *freed)
+{
+  uint64 va, end, next;
+  pte_t *pte;
+  char *pa;
+  int n, done = 0, flush = 0;
+
+  va = p->swapva;
+  end = 0;
+  for(n = 0; n < SWAPSCAN && *nv < SWAPBATCH; n++){
+    if(va >= end && (va = swapregion(p, va, &end)) == MAXVA){
+      done = 1;
+      break;
+    }
+    if((pte = walkrange(p->pagetable, va, &next)) == 0 || (*pte & PTE_MEGA)){
+      va = next;
+      continue;
+    }
+    pa = (char*)PTE2PA(*pte);
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U)){
+      // not a user page, or already in swap.
+    } else if(krefcnt(pa) != 1){
+      // shared: copy-on-write, the page cache, or the zero page.
+    } else if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      flush = 1;
+    } else if(kislazy(pa) && (*pte & PTE_D) == 0){
+      *pte = 0;
+      kfree(pa);
+      vmaccount(p->pagetable, va, -1, 0);
+      (*freed)++;
+      flush = 1;
+    } else {
+      // a lazily freed page written since is not lazy now.
+      ksetlazy(pa, 0);
+      *pte &= ~PTE_D;
+      krefinc(pa);
+      v[*nv].va = va;
+      v[*nv].pa = pa;
+      v[*nv].slot = -1;
+      (*nv)++;
+      flush = 1;
+    }
+    va += PGSIZE;
+  }
+  p->swapva = done ? 0 : va;
+  if(flush)
+    tlbshootdown(p);
+  return done;
+}
+
+// Write the victims v[0..n) that swapclock() took from p, whose
+// pid and page table were pid and pagetable, to swap. Then page
+// out each one that p still maps the same way and has neither
+// used nor written, and drop kswapd's references. Returns the
+// number of pages freed.
+static int
+swapout(struct proc *p, int pid, pagetable_t pagetable, struct victim *v, int n)
+{
+  char *pages[SWAPBATCH];
+  int i, j, k, m, slot, freed = 0;
+  pte_t *pte;
+
+  for(i = 0; i < n; i += k){
+    if((k = swapalloc(n - i, &slot)) == 0)
+      break;
+    // pages[0..m) go to the slots before slot+j on disk.
+    for(j = m = 0; j < k; j++){
+      v[i+j].slot = slot + j;
+      if(zswap_store(slot + j, v[i+j].pa) == 0){
+        if(m > 0)
+          swapio(slot + j - m, pages, m, 1);
+        m = 0;
+      } else {
+        pages[m++] = v[i+j].pa;
+      }
+    }
+    if(m > 0)
+      swapio(slot + k - m, pages, m, 1);
+  }
+
+  acquire(&p->lock);
+  for(i = 0; i < n; i++){
+    if(v[i].slot < 0){
+      kfree(v[i].pa);
+      continue;
+    }
+    if(p->pid == pid && p->pagetable == pagetable && p->state != RUNNING &&
+       (pte = walk(pagetable, v[i].va, 0)) != 0 &&
+       (*pte & (PTE_V|PTE_A|PTE_D)) == PTE_V &&
+       PTE2PA(*pte) == (uint64)v[i].pa && krefcnt(v[i].pa) == 2){
+      *pte = SLOT2PTE(v[i].slot) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_SWAP;
+      kfree(v[i].pa);
+      vmaccount(pagetable, v[i].va, -1, 0);
+      freed++;
+    } else {
+      swapfree(v[i].slot);
+    }
+    kfree(v[i].pa);
+  }
+  if(freed > 0)
+    tlbshootdown(p);
+  release(&p->lock);
+  return freed;
+}
+
+// Move the clock hand over part of the memory of proc[swap.hand],
+// going on to the next process when done with it. Returns the
+// number of pages freed.
+static int
+swapscan(void)
+{
+  struct proc *p = &proc[swap.hand];
+  struct victim v[SWAPBATCH];
+  pagetable_t pagetable;
+  int pid, done = 1, nv = 0, freed = 0;
+
+  acquire(&p->lock);
+  if(p->state == RUNNABLE || p->state == SLEEPING)
+    done = swapclock(p, v, &nv, &freed);
+  pid = p->pid;
+  pagetable = p->pagetable;
+  release(&p->lock);
+
+  if(done)
+    swap.hand = (swap.hand + 1) % NPROC;
+  if(nv > 0)
+    freed += swapout(p, pid, pagetable, v, nv);
+  return freed;
+}
+
+// Page-out daemon. Whenever free memory drops below SWAPLOW pages
+// it sweeps the clock over the processes until SWAPHIGH pages are
+// free, or until the hand has gone round twice, which clears the
+// accessed bits and then finds them clear, without freeing any.
+// Runs as a kernel process started by main().
+void
+kswapd(void)
+{
+  int laps, hand, n;
+
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  for(;;){
+    acquire(&tickslock);
+    while(kfreepages() >= SWAPLOW)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    laps = 0;
+    while(kfreepages() < SWAPHIGH && laps < 2){
+      hand = swap.hand;
+      if((n = swapscan()) > 0){
+        laps = 0;
+        swap.stuck = 0;
+      } else if(swap.hand < hand){
+        laps++;
+      }
+    }
+    swap.stuck = laps == 2;
+    swap.sweeps++;
+
+    if(swap.stuck){
+      // wait a tick before sweeping again.
+      acquire(&tickslock);
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+    }
+  }
+}
+
+// Called from usertrap() by a process whose page fault failed,
+// perhaps for lack of memory, and by oom(): if free memory is
+// low, wait for kswapd to page some out. Returns 1 if the fault
+// should be retried, or 0 if memory was not low, so the fault
+// failed for another reason, or kswapd could not free any.
+int
+swapwait(void)
+{
+  struct proc *p = myproc();
+  int sweeps;
+
+  if(kfreepages() >= SWAPLOW)
+    return 0;
+  // the sweep under way may have passed p before it slept here,
+  // so give up only after a whole sweep that freed nothing.
+  sweeps = swap.sweeps;
+  acquire(&tickslock);
+  while(kfreepages() < SWAPLOW && !killed(p) &&
+        !(swap.stuck && swap.sweeps - sweeps >= 2))
+    sleep(&ticks, &tickslock);
+  release(&tickslock);
+  return kfreepages() >= SWAPLOW;
+}
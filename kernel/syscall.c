@@ -8,12 +8,12 @@
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
+// addr may lie in the heap, the stack or an mmap area;
+// copyin() checks that it is user memory.
 int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
-    return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
   return 0;
@@ -109,6 +109,15 @@ extern uint64 sys_waitpid(void);
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
 extern uint64 sys_freemem(void);
+extern uint64 sys_membench(void);
+extern uint64 sys_msync(void);
+extern uint64 sys_mprotect(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_mremap(void);
+extern uint64 sys_oomadj(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_setrlimit(void);
+extern uint64 sys_spawn(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -142,6 +151,15 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mmap] sys_mmap,
 [SYS_munmap] sys_munmap,
 [SYS_freemem] sys_freemem,
+[SYS_membench] sys_membench,
+[SYS_msync] sys_msync,
+[SYS_mprotect] sys_mprotect,
+[SYS_madvise] sys_madvise,
+[SYS_mremap] sys_mremap,
+[SYS_oomadj] sys_oomadj,
+[SYS_memstat] sys_memstat,
+[SYS_setrlimit] sys_setrlimit,
+[SYS_spawn] sys_spawn,
 };
 
 void
@@ -28,3 +28,12 @@
 #define SYS_mmap 27
 #define SYS_munmap 28
 #define SYS_freemem 29
+#define SYS_membench 30
+#define SYS_msync 31
+#define SYS_mprotect 32
+#define SYS_madvise 33
+#define SYS_mremap 34
+#define SYS_oomadj 35
+#define SYS_memstat 36
+#define SYS_setrlimit 37
+#define SYS_spawn 38
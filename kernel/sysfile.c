@@ -431,20 +431,24 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Copy the user's argument vector at uargv into argv[MAXARG],
+// a page per string. Returns 0, or -1 with nothing left to free.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -460,18 +464,57 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
 
-  int ret = kexec(path, argv);
+ bad:
+  freeargv(argv);
+  return -1;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = kexec(myproc(), path, argv);
 
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv, fds, nfds): start the program at path in
+// a new process. fds, if not 0, lists the caller's descriptors
+// that become the child's 0..nfds-1; see kspawn().
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int fds[NOFILE], nfds;
+  uint64 uargv, ufds;
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufds);
+  argint(3, &nfds);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if(ufds != 0 && (nfds < 0 || nfds > NOFILE ||
+     copyin(myproc()->pagetable, (char*)fds, ufds, nfds*sizeof(int)) < 0))
+    return -1;
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = kspawn(path, argv, ufds != 0 ? fds : 0, nfds);
+
+  freeargv(argv);
+  return ret;
 }
 
 uint64
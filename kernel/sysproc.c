@@ -55,7 +55,7 @@ sys_sbrk(void)
     // Lazily allocate memory for this process: increase its memory
     // size but don't allocate memory. If the processes uses the
     // memory, vmfault() will allocate it.
-    if(addr + n < addr)
+    if(addr + n < addr || !mmap_heapfits(myproc(), addr + n))
       return -1;
     myproc()->sz += n;
   }
@@ -148,15 +148,120 @@ sys_waitpid(void)
 }
 
 uint64
-sys_mmap(void){
+sys_mmap(void)
+{
+	uint64 addr;
+	int length, prot, flags, fd, offset;
+
+	argaddr(0, &addr);
+	argint(1, &length);
+	argint(2, &prot);
+	argint(3, &flags);
+	argint(4, &fd);
+	argint(5, &offset);
+	return mmap(addr, length, prot, flags, fd, offset);
+}
+
+uint64
+sys_munmap(void)
+{
 	uint64 addr;
 	int length;
-    int prot;
-    int flags;
-    int fd;
-    int offset;
-    
-    if(argaddr(0, &addr) < 0 || argint(1,&length)<0 || argint(2,&prot)<0 || argint(3, &flags)<0 || argint(4, &fd)<0 || argint(5,&offset)<0) return -1;
-
-    return mmap(addr, length, prot, flags, fd, offset);
+
+	argaddr(0, &addr);
+	argint(1, &length);
+	return munmap(addr, length);
+}
+
+uint64
+sys_freemem(void)
+{
+	return freemem();
+}
+
+uint64
+sys_membench(void)
+{
+	membench();
+	return 0;
+}
+
+uint64
+sys_msync(void)
+{
+	uint64 addr;
+	int length;
+
+	argaddr(0, &addr);
+	argint(1, &length);
+	return msync(addr, length);
+}
+
+uint64
+sys_mprotect(void)
+{
+	uint64 addr;
+	int length, prot;
+
+	argaddr(0, &addr);
+	argint(1, &length);
+	argint(2, &prot);
+	return mprotect(addr, length, prot);
+}
+
+uint64
+sys_madvise(void)
+{
+	uint64 addr;
+	int length, advice;
+
+	argaddr(0, &addr);
+	argint(1, &length);
+	argint(2, &advice);
+	return madvise(addr, length, advice);
+}
+
+uint64
+sys_mremap(void)
+{
+	uint64 addr;
+	int oldlen, newlen, flags;
+
+	argaddr(0, &addr);
+	argint(1, &oldlen);
+	argint(2, &newlen);
+	argint(3, &flags);
+	return mremap(addr, oldlen, newlen, flags);
+}
+
+uint64
+sys_oomadj(void)
+{
+	int pid, adj;
+
+	argint(0, &pid);
+	argint(1, &adj);
+	return oomadj(pid, adj);
+}
+
+uint64
+sys_memstat(void)
+{
+	int pid;
+	uint64 addr;
+
+	argint(0, &pid);
+	argaddr(1, &addr);
+	return memstat(pid, addr);
+}
+
+uint64
+sys_setrlimit(void)
+{
+	int resource;
+	uint64 max;
+
+	argint(0, &resource);
+	argaddr(1, &max);
+	return setrlimit(resource, max);
 }
@@ -36,8 +36,6 @@ trapinithart(void)
 // return value is user satp for trampoline.S to switch to.
 //
 
-extern int handle_mmap_pgfault(struct proc *p, uint64 fault_va, int is_write);
-
 uint64
 usertrap(void)
 {
@@ -75,14 +73,14 @@ usertrap(void)
   } else if((sc == 15 || sc == 13)){
       uint64 faultva = r_stval();
       int is_write = (sc==15);
-      int handled = 0;
-
-      if(handle_mmap_pgfault(p, faultva, is_write) == 1) handled = 1;
-
-      if(!handled && vmfault(p->pagetable, badva, !is_write) != 0)
-          handled = 1;
-
-      if(!handled) setkiled(p);
+      int handled = userfault(p->pagetable, faultva, is_write) == 0;
+      // out of memory? wait for kswapd to page some out.
+      while(!handled && swapwait())
+        handled = userfault(p->pagetable, faultva, is_write) == 0;
+
+      if(!handled) setkilled(p);
+      // the hart may have cached the old, invalid PTE.
+      else sfence_vma_page(faultva, p->asid & SATP_ASID_MASK);
   } else {
     printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
     printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
@@ -101,6 +99,12 @@ usertrap(void)
     p->vruntime += weighted_delta_vruntime;
     p->timeslice -= 1;
     //수정 끝
+    if(++p->wbticks >= WBTICKS){
+      p->wbticks = 0;
+      mmap_collectall(p);
+      if(p->nlazy > 0 && kfreepages() < FREELOW)
+        lazyreclaim(p);
+    }
     if(p->timeslice<=0){
       update_vdeadline(p);
       yield();
@@ -110,7 +114,7 @@ usertrap(void)
   prepare_return();
 
   // the user page table to switch to, for trampoline.S
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = procsatp(p);
 
   // return to trampoline.S; satp value in a0.
   return satp;
@@ -46,7 +46,8 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b;   // or 0 for virtio_disk_rwpages()
+    char busy;       // virtio_disk_rwpages() request in flight
     char status;
   } info[NUM];
 
@@ -196,12 +197,12 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// buffer cache transfers always use three descriptors.
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,6 +213,23 @@ alloc3_desc(int *idx)
   return 0;
 }
 
+// tell the device about the chain of descriptors starting at i.
+static void
+submit(int i)
+{
+  // tell the device the first index in our chain of descriptors.
+  disk.avail->ring[disk.avail->idx % NUM] = i;
+
+  __sync_synchronize();
+
+  // tell the device another avail ring entry is available.
+  disk.avail->idx += 1; // not % NUM ...
+
+  __sync_synchronize();
+
+  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
 void
 virtio_disk_rw(struct buf *b, int write)
 {
@@ -226,7 +244,7 @@ virtio_disk_rw(struct buf *b, int write)
   // allocate the three descriptors.
   int idx[3];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, 3) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
@@ -268,24 +286,68 @@ virtio_disk_rw(struct buf *b, int write)
   b->disk = 1;
   disk.info[idx[0]].b = b;
 
-  // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  submit(idx[0]);
 
-  __sync_synchronize();
+  // Wait for virtio_disk_intr() to say request has finished.
+  while(b->disk == 1) {
+    sleep(b, &disk.vdisk_lock);
+  }
 
-  // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  disk.info[idx[0]].b = 0;
+  free_chain(idx[0]);
 
-  __sync_synchronize();
+  release(&disk.vdisk_lock);
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// Read or write the n pages at pages[] from or to the disk
+// starting at sector, in one request with a data descriptor
+// per page. Used by swap, which bypasses the buffer cache.
+void
+virtio_disk_rwpages(uint64 sector, char **pages, int n, int write)
+{
+  int idx[NUM];
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  if(n < 1 || n + 2 > NUM)
+    panic("virtio_disk_rwpages");
+
+  acquire(&disk.vdisk_lock);
+
+  while(alloc_descs(idx, n + 2) != 0)
+    sleep(&disk.free[0], &disk.vdisk_lock);
+
+  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+
+  buf0->type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  buf0->reserved = 0;
+  buf0->sector = sector;
+
+  disk.desc[idx[0]].addr = (uint64) buf0;
+  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  disk.desc[idx[0]].next = idx[1];
+
+  for(int i = 1; i <= n; i++){
+    disk.desc[idx[i]].addr = (uint64) pages[i-1];
+    disk.desc[idx[i]].len = PGSIZE;
+    disk.desc[idx[i]].flags = write ? 0 : VRING_DESC_F_WRITE;
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
   }
 
+  disk.info[idx[0]].status = 0xff; // device writes 0 on success
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
+
   disk.info[idx[0]].b = 0;
+  disk.info[idx[0]].busy = 1;
+
+  submit(idx[0]);
+
+  while(disk.info[idx[0]].busy)
+    sleep(&disk.info[idx[0]], &disk.vdisk_lock);
+
   free_chain(idx[0]);
 
   release(&disk.vdisk_lock);
@@ -317,8 +379,13 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    if(b){
+      b->disk = 0;   // disk is done with buf
+      wakeup(b);
+    } else {
+      disk.info[id].busy = 0;
+      wakeup(&disk.info[id]);
+    }
 
     disk.used_idx += 1;
   }
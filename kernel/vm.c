@@ -6,25 +6,33 @@
 #include "defs.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
 #include "fs.h"
+#include "file.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// a page of zeros, mapped read-only and copy-on-write by
+// read faults on lazily allocated memory. the kernel keeps
+// one reference to it forever, so it is never freed.
+static char *zeropage;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+extern struct proc proc[NPROC];
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -66,6 +74,8 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  if((zeropage = kalloc_zeroed()) == 0)
+    panic("kvminit: zeropage");
 }
 
 // Switch the current CPU's h/w page table register to
@@ -82,9 +92,53 @@ kvminithart()
   sfence_vma();
 }
 
+// The process that pagetable belongs to, or 0: the kernel's
+// page table, or one exec() is building, which it counts
+// when it commits to it (see vmrecount()).
+// The scan of proc[] takes no locks. The caller is the owner,
+// holds its p->lock (kswapd, ksmd), or is still setting up a
+// process nothing else can run (fork, spawn), so the owner's
+// p->pagetable cannot change under it. No other slot can hold
+// pagetable either: exec() and freeproc() clear the old
+// pointer before its pages are freed for reuse.
+static struct proc *
+ptowner(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p && p->pagetable == pagetable)
+    return p;
+  for(p = proc; p < &proc[NPROC]; p++)
+    if(p->pagetable == pagetable)
+      return p;
+  return 0;
+}
+
+// Count n more resident pages at va in pagetable (fewer if
+// n < 0) and npt more page-table pages, in the memory use of
+// the process it belongs to. kswapd and ksmd may change the
+// page table while its process does, so the counts are
+// updated atomically.
+void
+vmaccount(pagetable_t pagetable, uint64 va, int n, int npt)
+{
+  struct proc *p;
+
+  if((p = ptowner(pagetable)) == 0)
+    return;
+  if(n != 0 && va < TRAPFRAME){
+    __sync_fetch_and_add(&p->rss, n);
+    if(va >= MMAPBASE)
+      __sync_fetch_and_add(&p->mmpages, n);
+  }
+  if(npt != 0)
+    __sync_fetch_and_add(&p->ptpages, npt);
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
+// If va lies in a megapage, return its level-1 leaf PTE.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -97,23 +151,79 @@ kvminithart()
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
+  pagetable_t root = pagetable;
+
   if(va >= MAXVA)
     panic("walk");
 
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
+      vmaccount(root, va, 0, 1);
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Return the address of the level-1 PTE for va, creating
+// the level-1 page-table page if needed. Returns 0 if out
+// of memory.
+static pte_t *
+walkmega(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte = &pagetable[PX(2, va)];
+  pagetable_t pt;
+
+  if(*pte & PTE_V) {
+    pt = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if((pt = (pde_t*)kalloc_zeroed()) == 0)
+      return 0;
+    *pte = PA2PTE(pt) | PTE_V;
+    vmaccount(pagetable, va, 0, 1);
+  }
+  return &pt[PX(1, va)];
+}
+
+// Like walk(pagetable, va, 0), for loops over a range of
+// addresses. If va lies in a megapage, return its level-1
+// PTE (which has PTE_MEGA set) and set *next to the end of
+// the megapage. If the level-0 page-table page covering va
+// exists, return the address of va's PTE and set *next to
+// the end of the 2 MiB that page covers; the caller can
+// visit the following PTEs by incrementing the pointer.
+// Otherwise return 0 and set *next to the end of the
+// unpopulated level-1 or level-2 subtree containing va,
+// so the caller skips it without looking at its PTEs.
+pte_t *
+walkrange(pagetable_t pagetable, uint64 va, uint64 *next)
+{
+  if(va >= MAXVA)
+    panic("walkrange");
+
+  for(int level = 2; level > 0; level--) {
+    pte_t *pte = &pagetable[PX(level, va)];
+    if((*pte & PTE_V) == 0){
+      *next = (va | ((1L << PXSHIFT(level)) - 1)) + 1;
+      return 0;
+    }
+    if(level == 1 && (*pte & PTE_MEGA)){
+      *next = MEGAROUNDDOWN(va) + MEGAPGSIZE;
+      return pte;
+    }
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  *next = (va | ((1L << PXSHIFT(1)) - 1)) + 1;
+  return &pagetable[PX(0, va)];
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -134,12 +244,16 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(*pte & PTE_MEGA)
+    pa += (va & (MEGAPGSIZE-1)) & ~(PGSIZE-1);
   return pa;
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
 // va and size MUST be page-aligned.
+// Wherever va and pa are both 2 MiB aligned and at least
+// 2 MiB remain, a single level-1 megapage PTE is used.
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
@@ -147,6 +261,7 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
   uint64 a, last;
   pte_t *pte;
+  int n = 0, r = -1;
 
   if((va % PGSIZE) != 0)
     panic("mappages: va not aligned");
@@ -160,17 +275,39 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = va;
   last = va + size - PGSIZE;
   for(;;){
+    if((a % MEGAPGSIZE) == 0 && (pa % MEGAPGSIZE) == 0 &&
+       last - a >= MEGAPGSIZE - PGSIZE){
+      if((pte = walkmega(pagetable, a)) == 0)
+        break;
+      if((*pte & PTE_V) == 0){
+        *pte = PA2PTE(pa) | perm | PTE_MEGA | PTE_V;
+        n += MEGAPGSIZE/PGSIZE;
+        if(last - a == MEGAPGSIZE - PGSIZE){
+          r = 0;
+          break;
+        }
+        a += MEGAPGSIZE;
+        pa += MEGAPGSIZE;
+        continue;
+      }
+      // some of this 2 MiB is already mapped with
+      // 4 KiB pages; fall through and add to them.
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
-      return -1;
-    if(*pte & PTE_V)
+      break;
+    if(*pte & (PTE_V|PTE_SWAP))
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
+    n++;
+    if(a == last){
+      r = 0;
       break;
+    }
     a += PGSIZE;
     pa += PGSIZE;
   }
-  return 0;
+  vmaccount(pagetable, va, n, 0);
+  return r;
 }
 
 // create an empty user page table.
@@ -179,36 +316,59 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
 // Remove npages of mappings starting from va. va must be
 // page-aligned. It's OK if the mappings don't exist.
-// Optionally free the physical memory.
+// Optionally free the physical memory, and the swap
+// slots of pages in swap.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end, next;
   pte_t *pte;
+  int n = 0;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0) // leaf page table entry allocated?
-      continue;   
-    if((*pte & PTE_V) == 0)  // has physical page been allocated?
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a = next){
+    if((pte = walkrange(pagetable, a, &next)) == 0) // leaf page table allocated?
       continue;
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+    if(next > end)
+      next = end;
+    if(*pte & PTE_MEGA){
+      if(a != MEGAROUNDDOWN(a) || next - a != MEGAPGSIZE)
+        panic("uvmunmap: partial megapage");
+      if(do_free)
+        khugefree((void*)PTE2PA(*pte));
+      *pte = 0;
+      n += MEGAPGSIZE/PGSIZE;
+      continue;
+    }
+    for(; a < next; a += PGSIZE, pte++){
+      if(*pte & PTE_SWAP){
+        if(do_free)
+          swapfree(PTE2SLOT(*pte));
+        *pte = 0;
+        continue;
+      }
+      if((*pte & PTE_V) == 0)  // has physical page been allocated?
+        continue;
+      if(do_free){
+        uint64 pa = PTE2PA(*pte);
+        kfree((void*)pa);
+      }
+      *pte = 0;
+      n++;
     }
-    *pte = 0;
   }
+  vmaccount(pagetable, va, -n, 0);
 }
 
 // Allocate PTEs and physical memory to grow a process from oldsz to
@@ -224,12 +384,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -239,6 +398,249 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
   return newsz;
 }
 
+// Map the 2 MiB-aligned range at va with one megapage of
+// zeroed, physically contiguous memory.
+// Returns 0 on success, -1 if part of the range already has
+// a page-table page or no free 2 MiB block is left; the
+// caller then falls back to 4 KiB pages.
+int
+uvmmega(pagetable_t pagetable, uint64 va, int perm)
+{
+  char *mem;
+
+  if((va % MEGAPGSIZE) != 0)
+    panic("uvmmega: not aligned");
+  if(walk(pagetable, va, 0) != 0)
+    return -1;
+  if((mem = khugealloc()) == 0)
+    return -1;
+  if(mappages(pagetable, va, MEGAPGSIZE, (uint64)mem, perm) != 0){
+    khugefree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// If va lies inside a megapage but not at its start, replace
+// the megapage with 512 level-0 PTEs for the same memory, so
+// that the part on either side of va can be unmapped or
+// protected separately.
+// returns 0 on success, -1 if out of memory.
+int
+uvmsplitmega(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t pt;
+  uint64 pa;
+  int flags;
+
+  if((va % MEGAPGSIZE) == 0)
+    return 0;
+  if((pte = walk(pagetable, va, 0)) == 0 || (*pte & PTE_MEGA) == 0)
+    return 0;
+  if((pt = (pagetable_t)kalloc_zeroed()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte) & ~PTE_MEGA;
+  for(int i = 0; i < MEGAPGSIZE/PGSIZE; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(pt) | PTE_V;
+  vmaccount(pagetable, va, 0, 1);
+  khugesplit((void*)pa);
+  return 0;
+}
+
+// The PTE for a page mapped with mmap protection prot.
+// PROT_NONE pages stay mapped but lose PTE_U. A writable
+// page that others may still share (excl == 0) is mapped
+// copy-on-write instead.
+static pte_t
+protpte(pte_t pte, int prot, int excl)
+{
+  pte &= ~(PTE_R|PTE_W|PTE_U|PTE_COW);
+  if((prot & (PROT_READ|PROT_WRITE)) == 0)
+    return pte | PTE_R;
+  pte |= PTE_U | PTE_R;
+  if(prot & PROT_WRITE)
+    pte |= excl ? PTE_W : PTE_COW;
+  return pte;
+}
+
+// Give the mapped pages of [va, va+npages*PGSIZE) protection
+// prot. share says the pages belong to a MAP_SHARED mapping
+// and may be written in place even if others map them.
+// Megapages in the range must be wholly inside it.
+// The caller must flush the TLB (see tlbshootdown()).
+void
+uvmprotect(pagetable_t pagetable, uint64 va, uint64 npages, int prot, int share)
+{
+  uint64 a, end, next, pa;
+  pte_t *pte;
+
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a = next){
+    if((pte = walkrange(pagetable, a, &next)) == 0)
+      continue;
+    if(next > end)
+      next = end;
+    if(*pte & PTE_MEGA){
+      // megapages are never shared; fork copies them.
+      *pte = protpte(*pte, prot, 1);
+      continue;
+    }
+    for(; a < next; a += PGSIZE, pte++){
+      if(*pte & PTE_SWAP){
+        *pte = protpte(*pte, prot, share || swapcount(PTE2SLOT(*pte)) == 1);
+        continue;
+      }
+      if((*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      *pte = protpte(*pte, prot,
+                     share || (pa != (uint64)zeropage && krefcnt((void*)pa) == 1));
+    }
+  }
+}
+
+// Move the pages mapped in [src, src+len) to [dst, dst+len),
+// which must be unmapped, PTE bits and all, without copying
+// the pages. A megapage moves whole if dst keeps its 2 MiB
+// alignment and is split first otherwise.
+// Returns 0 on success, or -1 if out of memory for page-table
+// pages, in which case nothing has moved. The caller must
+// flush the TLB.
+int
+uvmmove(pagetable_t pagetable, uint64 src, uint64 dst, uint64 len)
+{
+  uint64 a, next, end = src + len, d = dst - src;
+  pte_t *pte, *dpte;
+  pagetable_t pt;
+  int i;
+
+  // first make the page-table pages for dst, so that the
+  // moves below cannot fail half way.
+  for(a = src; a < end; a = next){
+    if((pte = walkrange(pagetable, a, &next)) == 0)
+      continue;
+    if(*pte & PTE_MEGA){
+      if((d % MEGAPGSIZE) == 0){
+        if((dpte = walkmega(pagetable, a + d)) == 0)
+          return -1;
+        if(*dpte & PTE_V){
+          // dst is unmapped but may still have its level-0
+          // page-table page, which the megapage replaces.
+          pt = (pagetable_t)PTE2PA(*dpte);
+          for(i = 0; i < 512; i++)
+            if(pt[i])
+              return -1;
+          kfree(pt);
+          *dpte = 0;
+          vmaccount(pagetable, a + d, 0, -1);
+        }
+        continue;
+      }
+      if(uvmsplitmega(pagetable, MEGAROUNDDOWN(a) + PGSIZE) < 0)
+        return -1;
+      pte = walk(pagetable, a, 0);
+    }
+    if(next > end)
+      next = end;
+    for(; a < next; a += PGSIZE, pte++)
+      if((*pte & (PTE_V|PTE_SWAP)) && walk(pagetable, a + d, 1) == 0)
+        return -1;
+  }
+
+  for(a = src; a < end; a = next){
+    if((pte = walkrange(pagetable, a, &next)) == 0)
+      continue;
+    if(*pte & PTE_MEGA){
+      *walkmega(pagetable, a + d) = *pte;
+      *pte = 0;
+      continue;
+    }
+    if(next > end)
+      next = end;
+    for(; a < next; a += PGSIZE, pte++){
+      if(*pte & (PTE_V|PTE_SWAP)){
+        *walk(pagetable, a + d, 0) = *pte;
+        *pte = 0;
+      }
+    }
+  }
+  return 0;
+}
+
+// Mark the pages of [va, va+npages*PGSIZE) that are private
+// to this mapping and writable as given up with MADV_FREE.
+// Their dirty bits are cleared, so that uvmreclaim() can tell
+// whether they were written again. Megapages and shared pages
+// are left alone. Returns the number of pages marked.
+// The caller must flush the TLB, or a write through a stale
+// entry would not set PTE_D.
+int
+uvmlazyfree(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  uint64 a, end, next, pa;
+  pte_t *pte;
+  int n = 0;
+
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a = next){
+    if((pte = walkrange(pagetable, a, &next)) == 0 || (*pte & PTE_MEGA))
+      continue;
+    if(next > end)
+      next = end;
+    for(; a < next; a += PGSIZE, pte++){
+      if((*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+        continue;
+      pa = PTE2PA(*pte);
+      if(krefcnt((void*)pa) != 1)
+        continue;
+      *pte &= ~PTE_D;
+      ksetlazy((void*)pa, 1);
+      n++;
+    }
+  }
+  return n;
+}
+
+// Free the pages of [va, va+npages*PGSIZE) marked by
+// uvmlazyfree() that nobody has written since, and unmark
+// the others. A freed page reads back as zeros on the next
+// fault. Returns the number of pages freed; if any were,
+// the caller must flush the TLB.
+int
+uvmreclaim(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  uint64 a, end, next, pa;
+  pte_t *pte;
+  int n = 0;
+
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a = next){
+    if((pte = walkrange(pagetable, a, &next)) == 0 || (*pte & PTE_MEGA))
+      continue;
+    if(next > end)
+      next = end;
+    for(; a < next; a += PGSIZE, pte++){
+      if((*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      if(!kislazy((void*)pa))
+        continue;
+      if((*pte & PTE_D) == 0 && krefcnt((void*)pa) == 1){
+        *pte = 0;
+        kfree((void*)pa);
+        n++;
+      } else {
+        ksetlazy((void*)pa, 0);
+      }
+    }
+  }
+  vmaccount(pagetable, va, -n, 0);
+  return n;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -259,6 +661,8 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
 // Recursively free page-table pages.
 // All leaf mappings must already have been removed.
+// The owner's count of page-table pages is left alone,
+// since it is going away or being recounted (see vmrecount()).
 void
 freewalk(pagetable_t pagetable)
 {
@@ -277,6 +681,40 @@ freewalk(pagetable_t pagetable)
   kfree((void*)pagetable);
 }
 
+// Add up the part of pagetable, a page table of the given
+// level, that maps from va into p's counts of memory use.
+static void
+countwalk(struct proc *p, pagetable_t pagetable, int level, uint64 va)
+{
+  uint64 a;
+  pte_t pte;
+
+  p->ptpages++;
+  for(int i = 0; i < 512; i++){
+    pte = pagetable[i];
+    a = va + ((uint64)i << PXSHIFT(level));
+    if((pte & PTE_V) == 0)
+      continue;
+    if(!PTE_LEAF(pte)){
+      countwalk(p, (pagetable_t)PTE2PA(pte), level - 1, a);
+    } else if(a < TRAPFRAME){
+      p->rss += 1 << (9*level);
+      if(a >= MMAPBASE)
+        p->mmpages += 1 << (9*level);
+    }
+  }
+}
+
+// Count p's memory use afresh, for a page table that was
+// built before it was p's: by allocproc() or exec(). From
+// then on vmaccount() keeps the counts.
+void
+vmrecount(struct proc *p)
+{
+  p->rss = p->mmpages = p->ptpages = 0;
+  countwalk(p, p->pagetable, 2, 0);
+}
+
 // Free user memory pages,
 // then free page-table pages.
 void
@@ -287,53 +725,291 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Give new a private copy of the megapage mapped by pte at va.
+// Falls back to 4 KiB pages if no 2 MiB block is free.
+// returns 0 on success, -1 if out of memory.
+static int
+uvmcopymega(pagetable_t new, uint64 va, pte_t pte)
+{
+  char *src = (char*)PTE2PA(pte);
+  int perm = PTE_FLAGS(pte) & (PTE_R|PTE_W|PTE_X|PTE_U);
+  uint64 off;
+  char *mem;
+
+  if(uvmmega(new, va, perm) == 0){
+    memmove((void*)PTE2PA(*walk(new, va, 0)), src, MEGAPGSIZE);
+    return 0;
+  }
+  for(off = 0; off < MEGAPGSIZE; off += PGSIZE){
+    if((mem = kalloc()) == 0)
+      break;
+    memmove(mem, src + off, PGSIZE);
+    if(mappages(new, va + off, PGSIZE, (uint64)mem, perm) != 0){
+      kfree(mem);
+      break;
+    }
+  }
+  if(off < MEGAPGSIZE){
+    uvmunmap(new, va, off / PGSIZE, 1);
+    return -1;
+  }
+  return 0;
+}
+
+// Given a parent process's page table, copy the mappings
+// of [start, end) into a child's page table.
+// Copies only the page table: the physical pages are
+// shared, and unless share is set, writable pages are
+// made read-only and copy-on-write in both parent and
+// child. Megapages are copied. Pages in swap are shared
+// too, by their swap slot.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int share)
+{
+  pte_t *pte, *npte;
+  uint64 pa, i, next;
+  uint flags;
+
+  for(i = start; i < end; i = next){
+    if((pte = walkrange(old, i, &next)) == 0)
+      continue;   // page table page hasn't been allocated
+    if(next > end)
+      next = end;
+    if(*pte & PTE_MEGA){
+      if(uvmcopymega(new, i, *pte) != 0)
+        goto err;
+      continue;
+    }
+    for(; i < next; i += PGSIZE, pte++){
+      if((*pte & (PTE_V|PTE_SWAP)) == 0)
+        continue;   // physical page hasn't been allocated
+      if(!share && (*pte & PTE_W))
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      if(*pte & PTE_SWAP){
+        if((npte = walk(new, i, 1)) == 0)
+          goto err;
+        *npte = *pte;
+        swapdup(PTE2SLOT(*pte));
+        continue;
+      }
+      pa = PTE2PA(*pte);
+      flags = PTE_FLAGS(*pte) & ~PTE_D;
+      if(mappages(new, i, PGSIZE, pa, flags) != 0)
+        goto err;
+      krefinc((void*)pa);
+    }
+    next = i;
+  }
+  // the parent's writable pages just became read-only.
+  sfence_vma();
+  return 0;
+
+ err:
+  sfence_vma();
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
+  return -1;
+}
+
+// Given a parent process's page table, copy
+// its memory into a child's page table,
+// copy-on-write.
+int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmcopyrange(old, new, 0, sz, 0);
+}
+
+// Resolve a write fault on a copy-on-write page at va:
+// give the faulting page table a private, writable copy,
+// or just make the page writable if nobody else shares it.
+// returns 0 on success, -1 if va is not a copy-on-write
+// page or if out of physical memory.
+int
+cowfault(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  uint64 pa, i;
+  uint64 pa;
   uint flags;
   char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      continue;   // page table entry hasn't been allocated
-    if((*pte & PTE_V) == 0)
-      continue;   // physical page hasn't been allocated
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(pa == (uint64)zeropage){
+    // first write to a page that has only been read.
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    *pte = PA2PTE(mem) | flags;
+    kfree(zeropage);
+  } else if(krefcnt((void*)pa) == 1){
+    // the other sharers have exited or copied already.
+    *pte = PA2PTE(pa) | flags;
+  } else {
     if((mem = kalloc()) == 0)
-      goto err;
+      return -1;
     memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    *pte = PA2PTE(mem) | flags;
+    kfree((void*)pa);
   }
+  sfence_vma_va(va);
   return 0;
+}
 
- err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+// Make pte, which maps a private page, map page s instead, which
+// has the same contents, or the zero page if s is 0. s is shared
+// read-only, so the PTE loses PTE_W and becomes copy-on-write if
+// it had it. The caller frees the old page and flushes the TLB.
+void
+uvmshare(pte_t *pte, char *s)
+{
+  if(s == 0)
+    s = zeropage;
+  krefinc(s);
+  *pte = PA2PTE(s) | (PTE_FLAGS(*pte) & ~(PTE_W|PTE_D)) | ((*pte & PTE_W) ? PTE_COW : 0);
+}
+
+// Handle a fault on user address va, for a user access or for
+// the kernel copying to or from user memory: read the page back
+// from swap, break copy-on-write sharing, fault in a page of an
+// mmap area, of the stack or of the executable, or allocate lazy
+// heap memory.
+// Returns 0 if va is now mapped for the access, -1 if the access
+// is not allowed, out of memory, or would take the process over
+// its RSS limit.
+int
+userfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  int r;
+
+  if(p && pagetable == p->pagetable && p->rss >= p->rsslimit){
+    // only breaking copy-on-write sharing, which does not
+    // add to the RSS, may go on.
+    return write && cowfault(pagetable, va) == 0 ? 0 : -1;
+  }
+  if((r = swapin(pagetable, va, write)) != 0)
+    return r > 0 ? 0 : -1;
+  if(write && cowfault(pagetable, va) == 0)
+    return 0;
+  if(p == 0 || pagetable != p->pagetable)
+    return -1;
+  if(handle_mmap_pgfault(p, va, write) == 1)
+    return 0;
+  if((r = execfault(p, va, write)) != 0)
+    return r > 0 ? 0 : -1;
+  if(vmfault(pagetable, va, !write) != 0)
+    return 0;
   return -1;
 }
 
-// mark a PTE invalid for user access.
-// used by exec for the user stack guard page.
-void
-uvmclear(pagetable_t pagetable, uint64 va)
+// The kernel copies to and from user memory through the direct
+// map of physical memory, translating user addresses in software.
+// A ucursor remembers the PTEs of the last 2 MiB looked up, so a
+// copy walks the page table once per 2 MiB instead of per page.
+struct ucursor {
+  uint64 lo, hi;    // [lo, hi) is covered by pte
+  pte_t *pte;       // PTE of lo, or the megapage PTE
+  int mega;
+};
+
+// Return the PTE of user page va, using and updating c.
+static pte_t *
+uwalk(pagetable_t pagetable, uint64 va, struct ucursor *c)
 {
   pte_t *pte;
-  
-  pte = walk(pagetable, va, 0);
-  if(pte == 0)
-    panic("uvmclear");
-  *pte &= ~PTE_U;
+  uint64 next;
+
+  if(va < c->lo || va >= c->hi){
+    if(va >= MAXVA || (pte = walkrange(pagetable, va, &next)) == 0)
+      return 0;
+    c->mega = (*pte & PTE_MEGA) != 0;
+    c->lo = c->mega ? MEGAROUNDDOWN(va) : va;
+    c->hi = next;
+    c->pte = pte;
+  }
+  return c->mega ? c->pte : c->pte + (va - c->lo) / PGSIZE;
+}
+
+// Return the physical address of user page va if pte maps it
+// for a kernel access on the user's behalf, else 0. Sets the
+// PTE's accessed and dirty bits as a user access would: kswapd
+// needs PTE_A to age the page, mmap_collect() needs PTE_D to
+// write a MAP_SHARED page back, and a MADV_FREE page written
+// by read() or copyout() must not be dropped as clean.
+static uint64
+upa(pte_t *pte, uint64 va, int write)
+{
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return 0;
+  if(write && (*pte & PTE_W) == 0)
+    return 0;
+  *pte |= write ? PTE_A|PTE_D : PTE_A;
+  if(*pte & PTE_MEGA)
+    return PTE2PA(*pte) + (va & (MEGAPGSIZE-1));
+  return PTE2PA(*pte);
+}
+
+// Translate user address va for a kernel access of up to len
+// bytes, faulting its page in as a user access would. Returns
+// the physical address and sets *n to the number of bytes from
+// va that are accessible and physically contiguous, so that
+// one memmove can copy them; or returns 0 if va is not
+// accessible.
+static uint64
+uxlate(pagetable_t pagetable, uint64 va, uint64 len, int write,
+       struct ucursor *c, uint64 *n)
+{
+  uint64 va0 = PGROUNDDOWN(va), a, pa;
+
+  if(va0 >= MAXVA)
+    return 0;
+  if((pa = upa(uwalk(pagetable, va0, c), va0, write)) == 0){
+    if(userfault(pagetable, va0, write) < 0)
+      return 0;
+    c->hi = 0;    // the fault may have made a page-table page
+    if((pa = upa(uwalk(pagetable, va0, c), va0, write)) == 0)
+      return 0;
+  }
+  for(a = va0 + PGSIZE; a < va + len && a < MAXVA; a += PGSIZE)
+    if(upa(uwalk(pagetable, a, c), a, write) != pa + (a - va0))
+      break;
+  *n = a - va < len ? a - va : len;
+  return pa + (va - va0);
+}
+
+// Fault in the pages of [va, va+len) that a copy to (write) or
+// from user memory would fault on, before the caller locks the
+// inode it copies to or from. A fault on a file mapping or on
+// the executable takes that file's inode lock, which the copy
+// must not do while holding another: the same inode would
+// deadlock against itself, two different ones against a
+// process locking them in the other order. Stops at the first
+// page that cannot be faulted in, leaving the error for the
+// copy to report.
+void
+uprefault(pagetable_t pagetable, uint64 va, uint64 len, int write)
+{
+  struct ucursor c = { 0 };
+  uint64 a;
+
+  if(va + len < va)
+    return;
+  for(a = PGROUNDDOWN(va); a < va + len && a < MAXVA; a += PGSIZE){
+    if(upa(uwalk(pagetable, a, &c), a, write) != 0)
+      continue;
+    if(userfault(pagetable, a, write) < 0)
+      return;
+    c.hi = 0;    // the fault may have made a page-table page
+  }
 }
 
 // Copy from kernel to user.
@@ -342,34 +1018,19 @@ uvmclear(pagetable_t pagetable, uint64 va)
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
-  uint64 n, va0, pa0;
-  pte_t *pte;
+  struct ucursor c = { 0 };
+  uint64 n, pa;
 
   while(len > 0){
-    va0 = PGROUNDDOWN(dstva);
-    if(va0 >= MAXVA)
-      return -1;
-  
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
-        return -1;
-      }
-    }
-
-    pte = walk(pagetable, va0, 0);
-    // forbid copyout over read-only user text pages.
-    if((*pte & PTE_W) == 0)
+    // forbids copyout over read-only user text pages and
+    // breaks copy-on-write sharing.
+    if((pa = uxlate(pagetable, dstva, len, 1, &c, &n)) == 0)
       return -1;
-      
-    n = PGSIZE - (dstva - va0);
-    if(n > len)
-      n = len;
-    memmove((void *)(pa0 + (dstva - va0)), src, n);
+    memmove((void *)pa, src, n);
 
     len -= n;
     src += n;
-    dstva = va0 + PGSIZE;
+    dstva += n;
   }
   return 0;
 }
@@ -380,28 +1041,24 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
-  uint64 n, va0, pa0;
+  struct ucursor c = { 0 };
+  uint64 n, pa;
 
   while(len > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
-        return -1;
-      }
-    }
-    n = PGSIZE - (srcva - va0);
-    if(n > len)
-      n = len;
-    memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    if((pa = uxlate(pagetable, srcva, len, 0, &c, &n)) == 0)
+      return -1;
+    memmove(dst, (void *)pa, n);
 
     len -= n;
     dst += n;
-    srcva = va0 + PGSIZE;
+    srcva += n;
   }
   return 0;
 }
 
+// true if the 8-byte word w has a zero byte.
+#define HASZERO(w) (((w) - 0x0101010101010101UL) & ~(w) & 0x8080808080808080UL)
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -409,44 +1066,40 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
-  int got_null = 0;
+  struct ucursor c = { 0 };
+  uint64 n, i, pa;
+  char *p;
 
-  while(got_null == 0 && max > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+  while(max > 0){
+    if((pa = uxlate(pagetable, srcva, max, 0, &c, &n)) == 0)
       return -1;
-    n = PGSIZE - (srcva - va0);
-    if(n > max)
-      n = max;
-
-    char *p = (char *) (pa0 + (srcva - va0));
-    while(n > 0){
-      if(*p == '\0'){
-        *dst = '\0';
-        got_null = 1;
-        break;
-      } else {
-        *dst = *p;
-      }
-      --n;
-      --max;
-      p++;
-      dst++;
+    p = (char *)pa;
+
+    // look for the '\0' a word at a time once p is aligned.
+    for(i = 0; i < n && ((uint64)(p + i) % 8) != 0 && p[i] != '\0'; i++)
+      ;
+    if(i < n && ((uint64)(p + i) % 8) == 0)
+      for(; i + 8 <= n && !HASZERO(*(uint64 *)(p + i)); i += 8)
+        ;
+    for(; i < n && p[i] != '\0'; i++)
+      ;
+
+    if(i < n){
+      memmove(dst, p, i + 1);
+      return 0;
     }
-
-    srcva = va0 + PGSIZE;
-  }
-  if(got_null){
-    return 0;
-  } else {
-    return -1;
+    memmove(dst, p, n);
+    max -= n;
+    dst += n;
+    srcva += n;
   }
+  return -1;
 }
 
 // allocate and map user memory if process is referencing a page
 // that was lazily allocated in sys_sbrk().
+// a read maps the shared zero page copy-on-write instead of
+// allocating; the first write replaces it (see cowfault).
 // returns 0 if va is invalid or already mapped, or if
 // out of physical memory, and physical address if successful.
 uint64
@@ -461,10 +1114,15 @@ vmfault(pagetable_t pagetable, uint64 va, int read)
   if(ismapped(pagetable, va)) {
     return 0;
   }
-  mem = (uint64) kalloc();
+  if(read){
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)zeropage, PTE_U|PTE_R|PTE_COW) != 0)
+      return 0;
+    krefinc(zeropage);
+    return (uint64)zeropage;
+  }
+  mem = (uint64) kalloc_zeroed();
   if(mem == 0)
     return 0;
-  memset((void *) mem, 0, PGSIZE);
   if (mappages(p->pagetable, va, PGSIZE, mem, PTE_W|PTE_U|PTE_R) != 0) {
     kfree((void *)mem);
     return 0;
@@ -479,28 +1137,103 @@ ismapped(pagetable_t pagetable, uint64 va)
   if (pte == 0) {
     return 0;
   }
-  if (*pte & PTE_V){
+  if (*pte & (PTE_V|PTE_SWAP)){
     return 1;
   }
   return 0;
 }
-static struct mmap_area* find_mmap_area(struct proc *p, uint64 fault_va,
-                                        uint64 *page_base, uint64 *page_off)
+// Return the page cache page holding the data at offset off
+// of file mapping ma, with a reference for the caller to map.
+// Every mapping of the file shares it; a writable private
+// mapping maps it PTE_COW and copies it on the first write.
+// Returns 0 if out of memory. Like execfault(), does not lock
+// ip again if the caller already holds its lock.
+char*
+mmap_filepage(struct mmap_area *ma, uint64 off)
 {
-  if(fault_va < MMAPBASE) return 0;
-  for(int i=0;i<MMAP_MAX_AREAS;i++){
-    struct mmap_area *ma = &p->mmap_areas[i];
-    if(!ma->used) continue;
-    uint64 start = MMAPBASE + ma->addr;
-    uint64 end   = start + ma->length;
-    if(fault_va >= start && fault_va < end){
-      uint64 va_page = PGROUNDDOWN(fault_va);
-      *page_base = va_page;
-      *page_off  = va_page - start; // area 내부 페이지 오프셋
-      return ma;
+  struct inode *ip = ma->f->ip;
+  char *pg;
+  int locked;
+
+  if((locked = holdingsleep(&ip->lock)) == 0)
+    ilock(ip);
+  if((pg = pcget(ip, (ma->offset + off) / PGSIZE)) != 0)
+    krefinc(pg);
+  if(!locked)
+    iunlock(ip);
+  return pg;
+}
+
+// After a file fault at offset off of ma, map the pages of
+// the surrounding FAULTAROUND-page block that are already in
+// the page cache, then queue readahead of the pages after
+// them. The readahead window doubles, up to RAMAX pages,
+// while each fault lands where the previous one's mapped run
+// ended, and drops back to RAMIN on any other fault.
+// MADV_SEQUENTIAL starts at RAMAX; MADV_RANDOM does none of this.
+static void
+mmap_faultaround(struct proc *p, struct mmap_area *ma, uint64 off, int perm)
+{
+  struct inode *ip = ma->f->ip;
+  uint64 base = MMAPBASE + ma->addr;
+  uint64 lo, hi, o;
+  uint pgno, n;
+  char *pg;
+  int locked;
+
+  if(ma->advice == MADV_RANDOM)
+    return;
+  if(ma->advice == MADV_SEQUENTIAL)
+    ma->ra_win = RAMAX;
+  else if(off == ma->ra_next && ma->ra_win > 0)
+    ma->ra_win = ma->ra_win*2 > RAMAX ? RAMAX : ma->ra_win*2;
+  else
+    ma->ra_win = RAMIN;
+
+  lo = off - off % (FAULTAROUND*PGSIZE);
+  hi = lo + FAULTAROUND*PGSIZE;
+  if(hi > ma->length)
+    hi = ma->length;
+
+  if((locked = holdingsleep(&ip->lock)) == 0)
+    ilock(ip);
+  for(o = lo; o < hi && p->rss < p->rsslimit; o += PGSIZE){
+    if(o == off || ismapped(p->pagetable, base + o))
+      continue;
+    if((pg = pclookup(ip, (ma->offset + o) / PGSIZE)) == 0)
+      continue;
+    krefinc(pg);
+    if(mappages(p->pagetable, base + o, PGSIZE, (uint64)pg, perm) != 0){
+      kfree(pg);
+      break;
     }
   }
-  return 0;
+
+  for(o = off + PGSIZE; o < hi && ismapped(p->pagetable, base + o); o += PGSIZE)
+    ;
+  ma->ra_next = o;
+
+  if(o < ma->length){
+    pgno = (ma->offset + o) / PGSIZE;
+    n = (ma->length - o) / PGSIZE;
+    if(n > ma->ra_win)
+      n = ma->ra_win;
+    if((uint64)pgno*PGSIZE < ip->size && pclookup(ip, pgno) == 0)
+      pcreadahead(ip, pgno, n);
+  }
+  if(!locked)
+    iunlock(ip);
+}
+
+static struct mmap_area* find_mmap_area(struct proc *p, uint64 fault_va,
+                                        uint64 *page_base, uint64 *page_off)
+{
+  struct mmap_area *ma = mmap_lookup(p, fault_va);
+  if(!ma) return 0;
+  uint64 va_page = PGROUNDDOWN(fault_va);
+  *page_base = va_page;
+  *page_off  = va_page - (MMAPBASE + ma->addr); // area 내부 페이지 오프셋
+  return ma;
 }
 
 int handle_mmap_pgfault(struct proc *p, uint64 fault_va, int is_write)
@@ -510,41 +1243,67 @@ int handle_mmap_pgfault(struct proc *p, uint64 fault_va, int is_write)
   if(!ma) return -1;
 
   // 보호 체크
+  if(!(ma->prot & (PROT_READ | PROT_WRITE))) return -1;
   if(is_write && !(ma->prot & PROT_WRITE)) return -1;
 
+  int perm = PTE_U | PTE_R;
+  if(ma->prot & PROT_WRITE) perm |= PTE_W;
+
   // 이미 매핑된가?
   pte_t *pte = walk(p->pagetable, vabase, 0);
   if(pte && (*pte & PTE_V)){
+    // 공유 중인 COW 페이지는 cowfault()만 처리한다
+    if(*pte & PTE_COW)
+      return -1;
     // 보호 폴트 업그레이드만 허용(선택)
     if(is_write && (ma->prot & PROT_WRITE)){
       *pte |= PTE_W;
-      sfence_vma(); // 안전
+      sfence_vma_va(vabase); // 이 페이지만
       return 1;
     }
     return -1;
   }
 
-  // 페이지 할당
-  char *mem = kalloc();
-  if(!mem) return -1;
-  memset(mem, 0, PGSIZE);
+  // MAP_HUGE: 영역 안에 통째로 들어가는 2MB 구간은 megapage 하나로 매핑.
+  // 연속 메모리가 없으면 아래의 4KB 경로로 대체한다
+  if(ma->flags & MAP_HUGE){
+    uint64 hbase = MEGAROUNDDOWN(vabase);
+    uint64 start = MMAPBASE + ma->addr;
+    if(hbase >= start && hbase + MEGAPGSIZE <= start + ma->length &&
+       uvmmega(p->pagetable, hbase, perm) == 0)
+      return 1;
+  }
 
-  // 파일 매핑이면 읽기
-  if(ma->f){
-    ilock(ma->f->ip);
-    int rn = readi(ma->f->ip, mem, ma->offset + off_in_area, PGSIZE);
-    iunlock(ma->f->ip);
-    if(rn < 0){ kfree(mem); return -1; }
-    // rn < PGSIZE면 나머지는 0패딩 그대로
+  // 익명 매핑의 읽기 폴트: 공유 zero page를 읽기 전용으로 매핑,
+  // 첫 쓰기에서 cowfault()가 개인 페이지로 바꾼다
+  if(!ma->f && !is_write){
+    int zperm = PTE_U | PTE_R;
+    if(ma->prot & PROT_WRITE) zperm |= PTE_COW;
+    if(mappages(p->pagetable, vabase, PGSIZE, (uint64)zeropage, zperm) < 0)
+      return -1;
+    krefinc(zeropage);
+    return 1;
   }
 
-  int perm = PTE_U | PTE_R;
-  if(ma->prot & PROT_WRITE) perm |= PTE_W;
+  // 페이지 할당: 파일 매핑은 page cache에서, 익명 매핑은 미리 0으로 채워진 페이지 사용
+  char *mem = ma->f ? mmap_filepage(ma, off_in_area) : kalloc_zeroed();
+  if(!mem) return -1;
+
+  // MAP_PRIVATE 파일 매핑은 cache 페이지를 COW로 공유
+  int cow = ma->f && (perm & PTE_W) && !(ma->flags & MAP_SHARED);
+  if(cow) perm = (perm & ~PTE_W) | PTE_COW;
 
   if(mappages(p->pagetable, vabase, PGSIZE, (uint64)mem, perm) < 0){
     kfree(mem);
     return -1;
   }
+  // 쓰기 폴트였다면 바로 개인 복사본을 만든다
+  if(cow && is_write && cowfault(p->pagetable, vabase) < 0)
+    return -1;
+
+  // 파일 매핑: 이미 cache에 있는 이웃 페이지도 매핑하고 readahead 시작
+  if(ma->f)
+    mmap_faultaround(p, ma, off_in_area, perm);
   // 필요 시 ma->populated = 1; // per-page로 쓰려면 생략
 
   // TLB flush는 사용자 페이지테이블 갱신 후 보통 필요 없음. 호출해도 무방.
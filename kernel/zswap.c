@@ -0,0 +1,306 @@
+// Compressed swap pool: kswapd compresses the pages it pages out
+// (see lz.c) and keeps them in memory, in a pool of at most
+// ZSWAPPAGES pages, so that most faults on them decompress
+// instead of reading the disk. Zero-filled pages take no space
+// at all. A page that does not compress to ZSWAPMAX bytes goes
+// to its swap slot on disk as before; when the pool is full,
+// kswapd writes the pages kept in one pool page back to their
+// slots on disk to make room.
+//
+// Pool pages are divided into ZCHUNKS chunks. A compressed page
+// takes a run of chunks within one pool page, starting with a
+// struct zhdr.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+
+#define ZCHUNKS 64                     // chunks per pool page
+#define ZCHUNK (PGSIZE / ZCHUNKS)      // bytes per chunk
+#define ZSWAPMAX (PGSIZE - PGSIZE/4)   // largest compressed page kept
+#define ZZERO (-1)                     // zswap.obj[] of a zero-filled page
+
+// the start of a compressed page in a pool page.
+struct zhdr {
+  int slot;
+  int len;    // of the compressed data that follows
+};
+
+struct zpage {
+  char *mem;     // the pool page, or 0
+  uint64 used;   // bit c set: chunk c is in use
+  uint64 start;  // bit c set: a compressed page starts at chunk c
+  int nfree;     // chunks not in use
+};
+
+struct {
+  struct spinlock lock;
+  struct zpage pool[ZSWAPPAGES];
+  // where swap slot s's page is kept: 0 if on disk, ZZERO if
+  // zero-filled, else 1 + its pool page * ZCHUNKS + its chunk.
+  int obj[NSWAP];
+  int hint;        // pool page zalloc() tries first
+  int wbhand;      // pool page zswap_writeback() tries first
+
+  // statistics for meminfo().
+  int npages;      // pool pages allocated
+  int nstored;     // pages kept compressed
+  int nzero;       // zero-filled pages kept
+  uint64 bytes;    // compressed bytes kept
+  int nwriteback;  // pages written back to disk for room
+} zswap;
+
+// used only by kswapd.
+static uchar zbuf[PGSIZE];               // compression output
+static char zwb[PGSIZE];                 // a page being written back
+static ushort ztab[1 << LZHASHBITS];     // lz_compress() hash table
+
+void
+zswapinit(void)
+{
+  initlock(&zswap.lock, "zswap");
+}
+
+// chunks taken by a compressed page of len bytes.
+static int
+zchunks(int len)
+{
+  return (sizeof(struct zhdr) + len + ZCHUNK - 1) / ZCHUNK;
+}
+
+// The first chunk of a run of n free chunks in used, or -1.
+static int
+zfit(uint64 used, int n)
+{
+  uint64 mask = n == ZCHUNKS ? ~0UL : (1UL << n) - 1;
+
+  for(int c = 0; c + n <= ZCHUNKS; c++)
+    if(((used >> c) & mask) == 0)
+      return c;
+  return -1;
+}
+
+// Find room for a compressed page of len bytes, adding a pool
+// page if needed and allowed. Returns the object number (see
+// zswap.obj[]), or 0 if there is no room.
+// The caller holds zswap.lock.
+static int
+zalloc(int len)
+{
+  int n = zchunks(len), i, c, free = -1;
+  struct zpage *zp;
+
+  for(int k = 0; k < ZSWAPPAGES; k++){
+    i = (zswap.hint + k) % ZSWAPPAGES;
+    zp = &zswap.pool[i];
+    if(zp->mem == 0){
+      if(free < 0)
+        free = i;
+      continue;
+    }
+    if(zp->nfree >= n && (c = zfit(zp->used, n)) >= 0)
+      goto found;
+  }
+  if(free < 0)
+    return 0;
+  i = free;
+  zp = &zswap.pool[i];
+  if((zp->mem = kalloc()) == 0)
+    return 0;
+  zp->used = zp->start = 0;
+  zp->nfree = ZCHUNKS;
+  zswap.npages++;
+  c = 0;
+
+found:
+  zp->used |= (n == ZCHUNKS ? ~0UL : (1UL << n) - 1) << c;
+  zp->start |= 1UL << c;
+  zp->nfree -= n;
+  zswap.hint = i;
+  return 1 + i*ZCHUNKS + c;
+}
+
+static struct zhdr *
+zhdr(int obj)
+{
+  struct zpage *zp = &zswap.pool[(obj - 1) / ZCHUNKS];
+  return (struct zhdr *)(zp->mem + ((obj - 1) % ZCHUNKS) * ZCHUNK);
+}
+
+// Free slot's page in the pool, if it is there, and the pool
+// page with it if that was the last one in it.
+// The caller holds zswap.lock.
+static void
+zfree(int slot)
+{
+  int obj = zswap.obj[slot], n, c;
+  struct zpage *zp;
+
+  zswap.obj[slot] = 0;
+  if(obj == 0)
+    return;
+  zswap.nstored--;
+  if(obj == ZZERO){
+    zswap.nzero--;
+    return;
+  }
+  zp = &zswap.pool[(obj - 1) / ZCHUNKS];
+  c = (obj - 1) % ZCHUNKS;
+  n = zchunks(zhdr(obj)->len);
+  zswap.bytes -= zhdr(obj)->len;
+  zp->used &= ~((n == ZCHUNKS ? ~0UL : (1UL << n) - 1) << c);
+  zp->start &= ~(1UL << c);
+  zp->nfree += n;
+  if(zp->used == 0){
+    kfree(zp->mem);
+    zp->mem = 0;
+    zswap.npages--;
+  }
+}
+
+// Write the pages kept in one pool page back to their swap slots
+// on disk, which frees the pool page. Returns -1 if the pool is
+// empty, else 0. Only kswapd calls this; it may sleep.
+static int
+zswap_writeback(void)
+{
+  struct zpage *zp;
+  int i, k, c, obj, slot;
+  struct zhdr *h;
+  char *pg = zwb;
+
+  acquire(&zswap.lock);
+  for(k = 0; k < ZSWAPPAGES; k++){
+    i = (zswap.wbhand + k) % ZSWAPPAGES;
+    if(zswap.pool[i].mem)
+      break;
+  }
+  if(k == ZSWAPPAGES){
+    release(&zswap.lock);
+    return -1;
+  }
+  zswap.wbhand = (i + 1) % ZSWAPPAGES;
+  zp = &zswap.pool[i];
+  // faults may take pages out of zp meanwhile; once the last
+  // one goes, zfree() frees zp->mem.
+  while(zp->mem){
+    for(c = 0; (zp->start & (1UL << c)) == 0; c++)
+      ;
+    obj = 1 + i*ZCHUNKS + c;
+    h = zhdr(obj);
+    slot = h->slot;
+    if(lz_decompress((uchar*)(h + 1), h->len, (uchar*)pg, PGSIZE) != PGSIZE)
+      panic("zswap_writeback");
+    release(&zswap.lock);
+
+    swapio(slot, &pg, 1, 1);
+
+    acquire(&zswap.lock);
+    // unless a fault freed the slot meanwhile, it is on disk now.
+    if(zswap.obj[slot] == obj){
+      zfree(slot);
+      zswap.nwriteback++;
+    }
+  }
+  release(&zswap.lock);
+  return 0;
+}
+
+// Keep the page pa that kswapd is paging out to slot in the pool.
+// Returns 0 if it is kept there, or -1 if it must be written to
+// disk. Only kswapd calls this; it may sleep.
+int
+zswap_store(int slot, char *pa)
+{
+  uint64 *w = (uint64*)pa;
+  int len, obj, i;
+  struct zhdr *h;
+
+  for(i = 0; i < PGSIZE/sizeof(uint64) && w[i] == 0; i++)
+    ;
+  if(i == PGSIZE/sizeof(uint64)){
+    acquire(&zswap.lock);
+    zswap.obj[slot] = ZZERO;
+    zswap.nstored++;
+    zswap.nzero++;
+    release(&zswap.lock);
+    return 0;
+  }
+
+  if((len = lz_compress((uchar*)pa, PGSIZE, zbuf, ZSWAPMAX, ztab)) < 0)
+    return -1;
+
+  acquire(&zswap.lock);
+  while((obj = zalloc(len)) == 0){
+    release(&zswap.lock);
+    if(zswap_writeback() < 0)
+      return -1;
+    acquire(&zswap.lock);
+  }
+  h = zhdr(obj);
+  h->slot = slot;
+  h->len = len;
+  memmove(h + 1, zbuf, len);
+  zswap.obj[slot] = obj;
+  zswap.nstored++;
+  zswap.bytes += len;
+  release(&zswap.lock);
+  return 0;
+}
+
+// If slot's page is kept in the pool, decompress it into mem
+// and return 1; else return 0. The page stays in the pool
+// until zswap_drop(), since fork() may share the slot.
+int
+zswap_load(int slot, char *mem)
+{
+  int obj;
+  struct zhdr *h;
+
+  acquire(&zswap.lock);
+  if((obj = zswap.obj[slot]) == 0){
+    release(&zswap.lock);
+    return 0;
+  }
+  if(obj == ZZERO){
+    memset(mem, 0, PGSIZE);
+  } else {
+    h = zhdr(obj);
+    if(lz_decompress((uchar*)(h + 1), h->len, (uchar*)mem, PGSIZE) != PGSIZE)
+      panic("zswap_load");
+  }
+  release(&zswap.lock);
+  return 1;
+}
+
+// slot is free: forget its page.
+void
+zswap_drop(int slot)
+{
+  acquire(&zswap.lock);
+  zfree(slot);
+  release(&zswap.lock);
+}
+
+// Print the pool's statistics, for meminfo().
+void
+zswapinfo(void)
+{
+  int nstored, nzero, npages, nwriteback, ratio;
+
+  acquire(&zswap.lock);
+  nstored = zswap.nstored;
+  nzero = zswap.nzero;
+  npages = zswap.npages;
+  nwriteback = zswap.nwriteback;
+  // the size of the pages kept compressed over their
+  // compressed size, in hundredths.
+  ratio = zswap.bytes ? (uint64)(nstored - nzero) * PGSIZE * 100 / zswap.bytes : 0;
+  release(&zswap.lock);
+
+  printf("zswap %d pages (%d zero-filled) in %d pool pages, compression %d.%d%d:1, %d written back\n",
+         nstored, nzero, npages, ratio / 100, ratio / 10 % 10, ratio % 10, nwriteback);
+}
@@ -109,6 +109,8 @@ main(int argc, char *argv[])
 
   for(i = 0; i < FSSIZE; i++)
     wsect(i, zeroes);
+  // the swap area follows the file system; 4096 is the kernel's PGSIZE.
+  wsect(FSSIZE + NSWAP*(4096/BSIZE) - 1, zeroes);
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
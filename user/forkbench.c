@@ -0,0 +1,68 @@
+// Measure fork latency as a function of parent size.
+// With copy-on-write fork the cost should barely grow
+// with the amount of memory the parent has touched.
+//
+// usage: forkbench [nfork]
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+int sizes[] = { 0, 1, 4, 16, 32 };   // MiB of touched heap
+
+int
+main(int argc, char *argv[])
+{
+  int nfork = 200;
+  char *base, *p;
+
+  if(argc > 1)
+    nfork = atoi(argv[1]);
+
+  printf("forkbench: %d forks per size\n", nfork);
+  printf("MiB\tticks\tfree pages after fork\n");
+
+  base = sbrk(0);
+  for(int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    int sz = sizes[i] * 1024 * 1024;
+    int cur = sbrk(0) - base;
+    if(sz > cur && sbrk(sz - cur) == SBRK_ERROR){
+      printf("forkbench: sbrk %d MiB failed\n", sizes[i]);
+      exit(1);
+    }
+    // touch every page so the parent really owns the memory.
+    for(p = base; p < base + sz; p += PGSIZE)
+      *p = 1;
+
+    int fd[2];
+    int free1 = 0;
+    int t0 = uptime();
+    for(int n = 0; n < nfork; n++){
+      if(n == 0 && pipe(fd) < 0){
+        printf("forkbench: pipe failed\n");
+        exit(1);
+      }
+      int pid = fork();
+      if(pid < 0){
+        printf("forkbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0){
+        if(n == 0){
+          int f = freemem();
+          write(fd[1], &f, sizeof(f));
+        }
+        exit(0);
+      }
+      if(n == 0){
+        read(fd[0], &free1, sizeof(free1));
+        close(fd[0]);
+        close(fd[1]);
+      }
+      wait(0);
+    }
+    int t1 = uptime();
+    printf("%d\t%d\t%d\n", sizes[i], t1 - t0, free1);
+  }
+  exit(0);
+}
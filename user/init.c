@@ -28,14 +28,10 @@ main(void)
     printf("Student ID: 2022311970\n");
     printf("Name: Eunje Lee\n");
     printf("===========Your Message===========\n");
-    pid = fork();
+    // sh gets init's console descriptors.
+    pid = spawn("sh", argv, 0, 0);
     if(pid < 0){
-      printf("init: fork failed\n");
-      exit(1);
-    }
-    if(pid == 0){
-      exec("sh", argv);
-      printf("init: exec sh failed\n");
+      printf("init: spawn sh failed\n");
       exit(1);
     }
 
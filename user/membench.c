@@ -0,0 +1,12 @@
+// Run the kernel's memset/memmove/memcmp microbenchmark,
+// which prints bytes per cycle for each implementation.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+int
+main(void)
+{
+  membench();
+  exit(0);
+}
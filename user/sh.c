@@ -52,6 +52,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 void runcmd(struct cmd*) __attribute__((noreturn));
 
 // Execute cmd.  Never returns.
@@ -131,6 +132,101 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Can cmd be started with spawn(), without forking the shell:
+// is it a command, or a pipeline of them, with redirections?
+int
+spawnable(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+
+  switch(cmd->type){
+  case EXEC:
+    return ((struct execcmd*)cmd)->argv[0] != 0;
+  case REDIR:
+    return spawnable(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    return spawnable(pcmd->left) && spawnable(pcmd->right);
+  }
+  return 0;
+}
+
+// Start cmd, which spawnable() accepts, with fd[0], fd[1] and
+// fd[2] as its standard input, output and error, doing what
+// runcmd() would in a forked shell. Returns the number of
+// processes started.
+int
+spawncmd(struct cmd *cmd, int *fd)
+{
+  int p[2], sfd[3], n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  memmove(sfd, fd, sizeof(sfd));
+  switch(cmd->type){
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(spawn(ecmd->argv[0], ecmd->argv, sfd, 3) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    // an inner redirection of the same fd wins, as in runcmd().
+    rcmd = (struct redircmd*)cmd;
+    if((sfd[rcmd->fd] = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    n = spawncmd(rcmd->cmd, sfd);
+    close(sfd[rcmd->fd]);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      return 0;
+    }
+    sfd[1] = p[1];
+    n = spawncmd(pcmd->left, sfd);
+    memmove(sfd, fd, sizeof(sfd));
+    sfd[0] = p[0];
+    n += spawncmd(pcmd->right, sfd);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  return 0;
+}
+
+// Run cmd and wait for it. Commands and pipelines are started
+// with spawn(), which does not copy the shell's memory; lists
+// run one part after the other; anything else runs in a forked
+// copy of the shell.
+void
+run(struct cmd *cmd)
+{
+  int fd[3] = { 0, 1, 2 };
+  struct listcmd *lcmd;
+  int n;
+
+  if(cmd->type == LIST){
+    lcmd = (struct listcmd*)cmd;
+    run(lcmd->left);
+    run(lcmd->right);
+  } else if(spawnable(cmd)){
+    for(n = spawncmd(cmd, fd); n > 0; n--)
+      wait(0);
+  } else {
+    if(fork1() == 0)
+      runcmd(cmd);
+    wait(0);
+  }
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -146,6 +242,7 @@ int
 main(void)
 {
   static char buf[100];
+  struct cmd *c;
   int fd;
 
   // Ensure that three file descriptors are open.
@@ -168,10 +265,9 @@ main(void)
       cmd[strlen(cmd)-1] = 0;  // chop \n
       if(chdir(cmd+3) < 0)
         fprintf(2, "cannot cd %s\n", cmd+3);
-    } else {
-      if(fork1() == 0)
-        runcmd(parsecmd(cmd));
-      wait(0);
+    } else if((c = parsecmd(cmd)) != 0){
+      run(c);
+      freecmd(c);
     }
   }
   exit(0);
@@ -330,18 +426,38 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+int syntaxerr;  // parsecmd() found an error
+
+// Report a syntax error: only the first one of a command, as
+// parsing goes on to the end.
+void
+syntax(char *msg)
+{
+  if(!syntaxerr)
+    fprintf(2, "%s\n", msg);
+  syntaxerr = 1;
+}
+
+// Parse command line s. The shell parses commands itself, so
+// an error must not exit: returns 0 instead.
 struct cmd*
 parsecmd(char *s)
 {
   char *es;
   struct cmd *cmd;
 
+  syntaxerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
   if(s != es){
-    fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    if(!syntaxerr)
+      fprintf(2, "leftovers: %s\n", s);
+    syntax("syntax");
+  }
+  if(syntaxerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -385,8 +501,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -411,8 +529,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -437,13 +557,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -497,3 +621,41 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free a parsed command.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
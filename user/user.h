@@ -1,6 +1,7 @@
 #define SBRK_ERROR ((char *)-1)
 
 struct stat;
+struct memstat;
 
 // system calls
 int fork(void);
@@ -30,8 +31,17 @@ int ps(int);
 int meminfo(void);
 int waitpid(int);
 uint64 mmap(uint64 addr, int length, int prot, int flags, int fd, int offset);
-int munmap(uint64 addr);
+int munmap(uint64 addr, int length);
 int freemem();
+int membench(void);
+int msync(uint64 addr, int length);
+int mprotect(uint64 addr, int length, int prot);
+int madvise(uint64 addr, int length, int advice);
+uint64 mremap(uint64 addr, int oldlen, int newlen, int flags);
+int oomadj(int pid, int adj);
+int memstat(int pid, struct memstat *st);
+int setrlimit(int resource, uint64 max);
+int spawn(const char *path, char **argv, int *fds, int nfds);
 
 // ulib.c
 int stat(const char*, struct stat*);
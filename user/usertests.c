@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/memstat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2402,7 +2403,7 @@ void argptest(char *s)
   close(fd);
 }
 
-// check that there's an invalid page beneath
+// check that there's an invalid gap beneath
 // the user stack, to catch stack overflow.
 void
 stacktest(char *s)
@@ -2413,7 +2414,7 @@ stacktest(char *s)
   pid = fork();
   if(pid == 0) {
     char *sp = (char *) r_sp();
-    sp -= USERSTACK*PGSIZE;
+    sp -= USTACKMAX;
     // the *sp should cause a trap.
     printf("%s: stacktest: read below stack %d\n", s, *sp);
     exit(1);
@@ -2698,6 +2699,1620 @@ lazy_copy(char *s)
   exit(0);
 }
 
+// pages handed back to the kernel and allocated again, eagerly
+// or by lazy faults, must read as zero even though kalloc() no
+// longer scrubs them; idle harts refill the zeroed pool meanwhile.
+void
+zeroalloc(char *s)
+{
+  enum { N = 64 };
+  char *a;
+  int i;
+
+  for(int round = 0; round < 2; round++){
+    a = sbrk(N*PGSIZE);
+    if(a == SBRK_ERROR){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < N*PGSIZE; i++){
+      if(a[i] != 0){
+        printf("%s: eager page not zeroed at %d\n", s, i);
+        exit(1);
+      }
+    }
+    memset(a, 0xaa, N*PGSIZE);
+    sbrk(-N*PGSIZE);
+    pause(1);
+
+    a = sbrklazy(N*PGSIZE);
+    for(i = 0; i < N*PGSIZE; i++){
+      if(a[i] != 0){
+        printf("%s: lazy page not zeroed at %d\n", s, i);
+        exit(1);
+      }
+    }
+    memset(a, 0x55, N*PGSIZE);
+    sbrk(-N*PGSIZE);
+  }
+}
+
+// fork shares pages copy-on-write: the child must not see
+// the parent's later writes or vice versa, a fork must not
+// copy the parent's memory up front, and a write from the
+// kernel (read() into a shared page) must break sharing too.
+void
+cowfork(char *s)
+{
+  enum { N = 256 };
+  char *a;
+  int i, pid, xstatus, fds[2];
+
+  a = sbrk(N*PGSIZE);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE] = i;
+
+  int free0 = freemem();
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(free0 - freemem() > N/2){
+      printf("%s: fork copied %d pages\n", s, free0 - freemem());
+      exit(1);
+    }
+    for(i = 0; i < N; i++)
+      a[i*PGSIZE] = -i;
+    // read() writes into a page still shared with the parent.
+    if(read(fds[0], a + 10*PGSIZE + 1, 1) != 1)
+      exit(1);
+    for(i = 0; i < N; i++){
+      if(a[i*PGSIZE] != (char)-i)
+        exit(1);
+    }
+    exit(a[10*PGSIZE + 1] == 'x' ? 0 : 1);
+  }
+  for(i = 0; i < N; i++){
+    if(a[i*PGSIZE] != (char)i){
+      printf("%s: parent saw child's write at page %d\n", s, i);
+      exit(1);
+    }
+    a[i*PGSIZE] = i + 1;
+  }
+  write(fds[1], "x", 1);
+  close(fds[0]);
+  close(fds[1]);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+  if(a[10*PGSIZE + 1] == 'x'){
+    printf("%s: child's read() landed in parent\n", s);
+    exit(1);
+  }
+  sbrk(-N*PGSIZE);
+}
+
+// reading untouched lazy memory maps the shared zero page
+// and must not consume physical pages; writing afterwards
+// gives the page a private copy.
+void
+zeropage(char *s)
+{
+  enum { N = 1024 };
+  char *a;
+  int i, sum = 0;
+
+  a = sbrklazy(N*PGSIZE);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrklazy failed\n", s);
+    exit(1);
+  }
+  int free0 = freemem();
+  for(i = 0; i < N; i++)
+    sum += a[i*PGSIZE + i];
+  if(sum != 0){
+    printf("%s: lazy memory not zero\n", s);
+    exit(1);
+  }
+  // allow for the page-table pages covering the region.
+  if(free0 - freemem() > 8){
+    printf("%s: reads consumed %d pages\n", s, free0 - freemem());
+    exit(1);
+  }
+  for(i = 0; i < N; i += 2)
+    a[i*PGSIZE] = 1;
+  for(i = 0; i < N; i++){
+    if(a[i*PGSIZE] != (i % 2 == 0) || a[i*PGSIZE + 1] != 0){
+      printf("%s: wrong data at page %d\n", s, i);
+      exit(1);
+    }
+  }
+  sbrk(-N*PGSIZE);
+}
+
+// fork and exit of a process with a huge, mostly unpopulated
+// lazy heap should cost about as much as with a small heap,
+// since the page table walkers skip empty subtrees.
+void
+lazyfork(char *s)
+{
+  enum { N = 20 };
+  int t[2];
+
+  for(int round = 0; round < 2; round++){
+    char *a = 0;
+    if(round == 1){
+      a = sbrklazy(REGION_SZ);
+      if(a == SBRK_ERROR){
+        printf("%s: sbrklazy failed\n", s);
+        exit(1);
+      }
+      for(char *p = a; p < a + REGION_SZ; p += REGION_SZ/16)
+        *p = 1;
+    }
+    int t0 = uptime();
+    for(int i = 0; i < N; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0)
+        exit(0);
+      wait(0);
+    }
+    t[round] = uptime() - t0;
+    if(round == 1)
+      sbrk(-REGION_SZ);
+  }
+  if(t[1] > 4*t[0] + 10){
+    printf("%s: %d forks took %d ticks with a 1 GiB lazy heap, %d without\n",
+           s, N, t[1], t[0]);
+    exit(1);
+  }
+}
+
+// a lazy heap grown past MMAPBASE keeps mmap() above it,
+// and sbrk() cannot then grow the heap into the area.
+void
+mmapheap(char *s)
+{
+  char *a = sbrklazy(REGION_SZ);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrklazy failed\n", s);
+    exit(1);
+  }
+  char *top = a + REGION_SZ;
+  top[-1] = 'h';
+  char *m = (char*)mmap(0, 4*PGSIZE, PROT_READ|PROT_WRITE,
+                        MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+  if(m == 0 || m < top){
+    printf("%s: mmap placed at %p, inside the heap ending at %p\n", s, m, top);
+    exit(1);
+  }
+  memset(m, 'm', 4*PGSIZE);
+  if(top[-1] != 'h'){
+    printf("%s: mmap overwrote the heap\n", s);
+    exit(1);
+  }
+  if(sbrklazy(m - top + PGSIZE) != SBRK_ERROR){
+    printf("%s: sbrk grew the heap into an mmap area\n", s);
+    exit(1);
+  }
+  munmap((uint64)m, 4*PGSIZE);
+  sbrk(-REGION_SZ);
+}
+
+// anonymous MAP_HUGE mappings, faulted in and populated:
+// 2 MiB-aligned chunks are backed by megapages, the tail
+// by 4 KiB pages, and munmap gives all the memory back.
+void
+hugemmap(char *s)
+{
+  uint64 len = 2*MEGAPGSIZE + PGSIZE;
+  int flags[] = { MAP_ANONYMOUS|MAP_HUGE, MAP_ANONYMOUS|MAP_HUGE|MAP_POPULATE };
+  int fds[2];
+  char buf[8];
+
+  for(int k = 0; k < 2; k++){
+    int free0 = freemem();
+    char *a = (char*)mmap(0, len, PROT_READ|PROT_WRITE, flags[k], -1, 0);
+    if(a == 0){
+      printf("%s: mmap failed\n", s);
+      exit(1);
+    }
+    if((uint64)a % MEGAPGSIZE != 0){
+      printf("%s: mmap returned unaligned %p\n", s, a);
+      exit(1);
+    }
+    for(uint64 i = 0; i < len; i += PGSIZE)
+      a[i] = i / PGSIZE;
+    for(uint64 i = 0; i < len; i += PGSIZE){
+      if(a[i] != (char)(i / PGSIZE) || a[i+1] != 0){
+        printf("%s: wrong data at offset %p\n", s, (void*)i);
+        exit(1);
+      }
+    }
+
+    // the kernel must find the right 4 KiB piece of a megapage.
+    if(pipe(fds) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    if(write(fds[1], a + MEGAPGSIZE + 3*PGSIZE, 1) != 1 ||
+       read(fds[0], buf, 1) != 1 || buf[0] != (char)(MEGAPGSIZE/PGSIZE + 3)){
+      printf("%s: copyin from megapage failed\n", s);
+      exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    if(munmap((uint64)a, len) < 0){
+      printf("%s: munmap failed\n", s);
+      exit(1);
+    }
+    // allow for the page-table pages left behind.
+    if(free0 - freemem() > 4){
+      printf("%s: munmap leaked %d pages\n", s, free0 - freemem());
+      exit(1);
+    }
+  }
+}
+
+// read-only file mappings share the inode's page cache:
+// a second mapping of the same file costs no data pages,
+// and later writes to the file show through.
+void
+mmapcache(char *s)
+{
+  enum { N = 16 };
+  char *name = "mmapcache.tmp";
+  static char buf[PGSIZE];
+  int fd, i;
+
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memset(buf, 'a' + i, PGSIZE);
+    if(write(fd, buf, PGSIZE) != PGSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+
+  char *a = (char*)mmap(0, N*PGSIZE, PROT_READ, MAP_POPULATE, fd, 0);
+  int free0 = freemem();
+  char *b = (char*)mmap(0, N*PGSIZE, PROT_READ, MAP_POPULATE, fd, 0);
+  if(a == 0 || b == 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  // allow for the page-table pages covering the second area.
+  if(free0 - freemem() > 2){
+    printf("%s: second mapping used %d pages\n", s, free0 - freemem());
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(a[i*PGSIZE] != 'a' + i || b[i*PGSIZE + PGSIZE-1] != 'a' + i){
+      printf("%s: wrong data in page %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  // the mappings must survive closing the fd.
+  close(fd);
+  fd = open(name, O_RDWR);
+  for(i = 0; i < 5; i++)
+    read(fd, buf, PGSIZE);
+  if(write(fd, "X", 1) != 1){
+    printf("%s: rewrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(a[5*PGSIZE] != 'X' || b[5*PGSIZE] != 'X'){
+    printf("%s: mapping did not see write\n", s);
+    exit(1);
+  }
+  munmap((uint64)a, N*PGSIZE);
+  munmap((uint64)b, N*PGSIZE);
+  unlink(name);
+}
+
+// stores through a MAP_SHARED file mapping reach the disk
+// on msync, munmap and exit.
+void
+mmapshared(char *s)
+{
+  enum { N = 3 };
+  char *name = "mmapshared.tmp";
+  static char buf[N*PGSIZE];
+  int fd, i, pid, xstatus;
+
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  memset(buf, 'a', sizeof(buf));
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+
+  for(int round = 0; round < 3; round++){
+    char *a = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(a == 0){
+      printf("%s: mmap failed\n", s);
+      exit(1);
+    }
+    if(round == 0){
+      // msync, then drop the mapping without writing more.
+      for(i = 0; i < N; i++)
+        a[i*PGSIZE + 1] = 'b';
+      if(msync((uint64)a, N*PGSIZE) < 0){
+        printf("%s: msync failed\n", s);
+        exit(1);
+      }
+      munmap((uint64)a, N*PGSIZE);
+    } else if(round == 1){
+      for(i = 0; i < N; i++)
+        a[i*PGSIZE + 2] = 'c';
+      munmap((uint64)a, N*PGSIZE);
+    } else {
+      pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0){
+        // the child's own mapping, written back by exit.
+        char *b = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        if(b == 0)
+          exit(1);
+        for(i = 0; i < N; i++)
+          b[i*PGSIZE + 3] = 'd';
+        exit(0);
+      }
+      wait(&xstatus);
+      if(xstatus != 0){
+        printf("%s: child failed\n", s);
+        exit(1);
+      }
+      munmap((uint64)a, N*PGSIZE);
+    }
+  }
+  close(fd);
+
+  // the last reference is gone, so this read comes from disk.
+  fd = open(name, O_RDONLY);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: reread failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < N; i++){
+    char *p = buf + i*PGSIZE;
+    if(p[0] != 'a' || p[1] != 'b' || p[2] != 'c' || p[3] != 'd' || p[4] != 'a'){
+      printf("%s: page %d not written back: %c%c%c%c%c\n",
+             s, i, p[0], p[1], p[2], p[3], p[4]);
+      exit(1);
+    }
+  }
+  unlink(name);
+}
+
+// a writable MAP_PRIVATE file mapping shares the cached
+// pages until it writes one, and never changes the file.
+void
+mmapprivate(char *s)
+{
+  enum { N = 8 };
+  char *name = "mmapprivate.tmp";
+  static char buf[N*PGSIZE];
+  int fd, i;
+
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  memset(buf, 'a', sizeof(buf));
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+
+  char *ro = (char*)mmap(0, N*PGSIZE, PROT_READ, MAP_POPULATE, fd, 0);
+  int free0 = freemem();
+  char *a = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE|MAP_POPULATE, fd, 0);
+  if(ro == 0 || a == 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  // allow for the page-table pages covering the second area.
+  if(free0 - freemem() > 2){
+    printf("%s: private mapping copied %d pages\n", s, free0 - freemem());
+    exit(1);
+  }
+  a[3*PGSIZE] = 'x';
+  if(free0 - freemem() > 3){
+    printf("%s: one write copied %d pages\n", s, free0 - freemem());
+    exit(1);
+  }
+  if(a[3*PGSIZE] != 'x' || a[3*PGSIZE+1] != 'a' || ro[3*PGSIZE] != 'a'){
+    printf("%s: write leaked to the shared page\n", s);
+    exit(1);
+  }
+  munmap((uint64)a, N*PGSIZE);
+  munmap((uint64)ro, N*PGSIZE);
+  close(fd);
+
+  fd = open(name, O_RDONLY);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: reread failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < sizeof(buf); i++){
+    if(buf[i] != 'a'){
+      printf("%s: file changed at %d\n", s, i);
+      exit(1);
+    }
+  }
+  unlink(name);
+}
+
+// faulting through a file mapping, sequentially and at random,
+// with fault-around and readahead mapping pages ahead of time.
+void
+mmapscan(char *s)
+{
+  enum { N = 48 };
+  char *name = "mmapscan.tmp";
+  static char buf[PGSIZE];
+  int fd, i;
+
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memset(buf, i, PGSIZE);
+    if(write(fd, buf, PGSIZE) != PGSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+
+  char *a = (char*)mmap(0, N*PGSIZE, PROT_READ, 0, fd, 0);
+  char *b = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(a == 0 || b == 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N*PGSIZE; i += 512){
+    if(a[i] != i / PGSIZE){
+      printf("%s: sequential read of page %d wrong\n", s, i / PGSIZE);
+      exit(1);
+    }
+  }
+  // visit pages in a scattered order, writing every third one.
+  for(int k = 0; k < N; k++){
+    i = (k * 17) % N;
+    if(k % 3 == 0)
+      b[i*PGSIZE + 7] = 'w';
+    if(b[i*PGSIZE] != i){
+      printf("%s: scattered read of page %d wrong\n", s, i);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if(a[i*PGSIZE + 7] != i){
+      printf("%s: private write showed in page %d\n", s, i);
+      exit(1);
+    }
+  }
+  munmap((uint64)a, N*PGSIZE);
+  munmap((uint64)b, N*PGSIZE);
+  close(fd);
+  unlink(name);
+}
+
+// munmap'd address ranges are handed out again, and many
+// small areas can be looked up and removed in any order.
+void
+mmapreuse(char *s)
+{
+  enum { N = 32 };
+  uint64 a[N];
+  int i;
+
+  uint64 first = mmap(0, 16*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  if(first == 0 || munmap(first, 16*PGSIZE) < 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 1000; i++){
+    uint64 b = mmap(0, 16*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+    if(b != first){
+      printf("%s: round %d got %p, not %p\n", s, i, (void*)b, (void*)first);
+      exit(1);
+    }
+    munmap(b, 16*PGSIZE);
+  }
+
+  for(i = 0; i < N; i++){
+    a[i] = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+    if(a[i] == 0){
+      printf("%s: mmap %d failed\n", s, i);
+      exit(1);
+    }
+    *(int*)a[i] = i;
+  }
+  for(i = 0; i < N; i += 2)
+    munmap(a[i], PGSIZE);
+  for(i = 1; i < N; i += 2){
+    if(*(int*)a[i] != i){
+      printf("%s: area %d lost its data\n", s, i);
+      exit(1);
+    }
+  }
+  // a two-page area fits in none of the one-page holes.
+  uint64 big = mmap(0, 2*PGSIZE, PROT_READ, MAP_ANONYMOUS, -1, 0);
+  if(big <= a[N-1]){
+    printf("%s: two-page area placed in a one-page hole\n", s);
+    exit(1);
+  }
+  munmap(big, 2*PGSIZE);
+  for(i = 1; i < N; i += 2)
+    munmap(a[i], PGSIZE);
+}
+
+// fork copies mmap areas: private ones copy-on-write,
+// shared file mappings really shared.
+void
+mmapfork(char *s)
+{
+  char *name = "mmapfork.tmp";
+  static char buf[PGSIZE];
+  int fd, pid, xstatus;
+
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  memset(buf, 'f', PGSIZE);
+  if(fd < 0 || write(fd, buf, PGSIZE) != PGSIZE){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  char *anon = (char*)mmap(0, 4*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  char *huge = (char*)mmap(0, MEGAPGSIZE, PROT_READ|PROT_WRITE,
+                           MAP_ANONYMOUS|MAP_HUGE|MAP_POPULATE, -1, 0);
+  char *shared = (char*)mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(anon == 0 || huge == 0 || shared == 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  anon[0] = 'p';
+  huge[MEGAPGSIZE - 1] = 'h';
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(anon[0] != 'p' || anon[PGSIZE] != 0 || huge[MEGAPGSIZE - 1] != 'h' ||
+       shared[0] != 'f')
+      exit(1);
+    anon[0] = 'c';
+    huge[MEGAPGSIZE - 1] = 'c';
+    shared[0] = 'c';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+  if(anon[0] != 'p' || huge[MEGAPGSIZE - 1] != 'h'){
+    printf("%s: child's write to a private area showed in the parent\n", s);
+    exit(1);
+  }
+  if(shared[0] != 'c'){
+    printf("%s: child's write to a shared area was lost\n", s);
+    exit(1);
+  }
+  munmap((uint64)anon, 4*PGSIZE);
+  munmap((uint64)huge, MEGAPGSIZE);
+  munmap((uint64)shared, PGSIZE);
+  close(fd);
+  unlink(name);
+}
+
+// run f on a in a child and return its exit status.
+static int
+mmapchild(void (*f)(char*), char *a)
+{
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    f(a);
+    exit(0);
+  }
+  wait(&xstatus);
+  return xstatus;
+}
+
+static void
+mmaptouch(char *a)
+{
+  *(volatile char*)a;
+}
+
+static void
+mmapwrite(char *a)
+{
+  *a = 'w';
+}
+
+// munmap of part of an area.
+void
+mmappartial(char *s)
+{
+  enum { N = 8 };
+  int free0 = freemem();
+  char *a = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  int i;
+
+  if(a == 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE] = i;
+
+  // a hole in the middle, then both edges.
+  if(munmap((uint64)a + 3*PGSIZE, 2*PGSIZE) < 0 ||
+     munmap((uint64)a, PGSIZE) < 0 ||
+     munmap((uint64)a + (N-1)*PGSIZE, PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    int gone = i == 0 || i == 3 || i == 4 || i == N-1;
+    if(gone && mmapchild(mmaptouch, a + i*PGSIZE) != -1){
+      printf("%s: page %d still mapped\n", s, i);
+      exit(1);
+    }
+    if(!gone && a[i*PGSIZE] != i){
+      printf("%s: page %d lost its data\n", s, i);
+      exit(1);
+    }
+  }
+  // unmapped parts of the range are skipped.
+  if(munmap((uint64)a, N*PGSIZE) < 0){
+    printf("%s: munmap of the whole range failed\n", s);
+    exit(1);
+  }
+
+  // a single page out of a megapage.
+  char *h = (char*)mmap(0, MEGAPGSIZE, PROT_READ|PROT_WRITE,
+                        MAP_ANONYMOUS|MAP_HUGE|MAP_POPULATE, -1, 0);
+  if(h == 0){
+    printf("%s: huge mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < MEGAPGSIZE/PGSIZE; i++)
+    h[i*PGSIZE] = i;
+  if(munmap((uint64)h + 100*PGSIZE, PGSIZE) < 0){
+    printf("%s: munmap in a megapage failed\n", s);
+    exit(1);
+  }
+  if(mmapchild(mmaptouch, h + 100*PGSIZE) != -1){
+    printf("%s: page still mapped in megapage\n", s);
+    exit(1);
+  }
+  for(i = 0; i < MEGAPGSIZE/PGSIZE; i++){
+    if(i != 100 && h[i*PGSIZE] != (char)i){
+      printf("%s: megapage lost data at page %d\n", s, i);
+      exit(1);
+    }
+  }
+  munmap((uint64)h, MEGAPGSIZE);
+
+  // allow for the page-table pages left behind.
+  if(free0 - freemem() > 4){
+    printf("%s: leaked %d pages\n", s, free0 - freemem());
+    exit(1);
+  }
+}
+
+// read() and write() with the user buffer in a not yet touched
+// mapping of the very file being read or written.
+void
+mmapread(char *s)
+{
+  enum { N = 4 };
+  char *name = "mmapread.tmp";
+  static char buf[N*PGSIZE];
+  int fd, i;
+
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  memset(buf, 'a', sizeof(buf));
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  char *a = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(a == 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open(name, O_RDWR);
+  if(fd < 0 || read(fd, a, N*PGSIZE) != N*PGSIZE){
+    printf("%s: read into the mapping failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N*PGSIZE; i++){
+    if(a[i] != 'a'){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  munmap((uint64)a, N*PGSIZE);
+
+  a = (char*)mmap(0, N*PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  fd = open(name, O_RDWR);
+  if(a == 0 || fd < 0 || write(fd, a, N*PGSIZE) != N*PGSIZE){
+    printf("%s: write from the mapping failed\n", s);
+    exit(1);
+  }
+  munmap((uint64)a, N*PGSIZE);
+  close(fd);
+  unlink(name);
+}
+
+void
+mprotecttest(char *s)
+{
+  enum { N = 4 };
+  char *name = "mprotectfile";
+  char *a = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  int i, fd;
+
+  if(a == 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE] = 'a' + i;
+
+  if(mprotect((uint64)a + PGSIZE, 2*PGSIZE, PROT_READ) < 0){
+    printf("%s: mprotect failed\n", s);
+    exit(1);
+  }
+  if(mmapchild(mmapwrite, a + PGSIZE) != -1 ||
+     mmapchild(mmapwrite, a + 2*PGSIZE) != -1){
+    printf("%s: wrote a read-only page\n", s);
+    exit(1);
+  }
+  if(mmapchild(mmapwrite, a) != 0 || mmapchild(mmapwrite, a + 3*PGSIZE) != 0 ||
+     mmapchild(mmaptouch, a + PGSIZE) != 0){
+    printf("%s: mprotect changed the wrong pages\n", s);
+    exit(1);
+  }
+
+  if(mprotect((uint64)a, PGSIZE, PROT_NONE) < 0 ||
+     mmapchild(mmaptouch, a) != -1){
+    printf("%s: read a PROT_NONE page\n", s);
+    exit(1);
+  }
+
+  // back to one writable area that kept its data.
+  if(mprotect((uint64)a, N*PGSIZE, PROT_READ|PROT_WRITE) < 0){
+    printf("%s: mprotect failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(a[i*PGSIZE] != 'a' + i){
+      printf("%s: page %d lost its data\n", s, i);
+      exit(1);
+    }
+    a[i*PGSIZE] = 'A' + i;
+  }
+  if(munmap((uint64)a, N*PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(mprotect((uint64)a, PGSIZE, PROT_READ) != -1){
+    printf("%s: mprotect of an unmapped page succeeded\n", s);
+    exit(1);
+  }
+
+  // a shared mapping of a read-only file cannot become writable.
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open(name, O_RDONLY);
+  a = (char*)mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  if(a == 0 || mprotect((uint64)a, PGSIZE, PROT_READ|PROT_WRITE) != -1){
+    printf("%s: shared read-only file made writable\n", s);
+    exit(1);
+  }
+  munmap((uint64)a, PGSIZE);
+  close(fd);
+  unlink(name);
+}
+
+void
+madvisetest(char *s)
+{
+  enum { N = 8 };
+  char *name = "madvisefile";
+  char buf[PGSIZE];
+  int i, fd, free0;
+
+  // heap pages.
+  char *top = sbrk((N+1)*PGSIZE);
+  char *h = (char*)PGROUNDUP((uint64)top);
+  for(i = 0; i < N; i++)
+    h[i*PGSIZE] = 'h';
+  free0 = freemem();
+  if(madvise((uint64)h, N*PGSIZE, MADV_DONTNEED) < 0 || freemem() - free0 < N){
+    printf("%s: MADV_DONTNEED did not free the heap\n", s);
+    exit(1);
+  }
+  free0 = freemem();
+  if(madvise((uint64)h, N*PGSIZE, MADV_WILLNEED) < 0 || free0 - freemem() < N){
+    printf("%s: MADV_WILLNEED did not map the heap\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(h[i*PGSIZE] != 0){
+      printf("%s: heap page %d kept its data\n", s, i);
+      exit(1);
+    }
+    h[i*PGSIZE] = 'f';
+  }
+  // freed lazily: a page written again keeps its new data,
+  // the others may or may not be gone.
+  if(madvise((uint64)h, N*PGSIZE, MADV_FREE) < 0){
+    printf("%s: MADV_FREE failed\n", s);
+    exit(1);
+  }
+  h[0] = 'g';
+  for(i = 1; i < N; i++){
+    if(h[i*PGSIZE] != 'f' && h[i*PGSIZE] != 0){
+      printf("%s: MADV_FREE page %d has junk\n", s, i);
+      exit(1);
+    }
+  }
+  if(h[0] != 'g'){
+    printf("%s: MADV_FREE lost a write\n", s);
+    exit(1);
+  }
+  sbrk(-(N+1)*PGSIZE);
+
+  // anonymous mmap pages.
+  char *a = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  if(a == 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(madvise((uint64)a, N*PGSIZE, MADV_WILLNEED) < 0){
+    printf("%s: MADV_WILLNEED failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE] = 'a';
+  free0 = freemem();
+  if(madvise((uint64)a + 2*PGSIZE, 4*PGSIZE, MADV_DONTNEED) < 0 || freemem() - free0 < 4){
+    printf("%s: MADV_DONTNEED did not free the area\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(a[i*PGSIZE] != (i >= 2 && i < 6 ? 0 : 'a')){
+      printf("%s: wrong data in page %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(madvise((uint64)a, N*PGSIZE, 5) != -1 ||
+     madvise((uint64)a + N*PGSIZE, PGSIZE, MADV_DONTNEED) != -1){
+    printf("%s: bad advice or range accepted\n", s);
+    exit(1);
+  }
+  munmap((uint64)a, N*PGSIZE);
+
+  // private file pages come back from the file.
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  memset(buf, 'x', PGSIZE);
+  for(i = 0; i < N; i++){
+    if(fd < 0 || write(fd, buf, PGSIZE) != PGSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  a = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(a == 0){
+    printf("%s: file mmap failed\n", s);
+    exit(1);
+  }
+  if(madvise((uint64)a, N*PGSIZE, MADV_SEQUENTIAL) < 0 ||
+     madvise((uint64)a + PGSIZE, PGSIZE, MADV_RANDOM) < 0 ||
+     madvise((uint64)a, N*PGSIZE, MADV_FREE) != -1){
+    printf("%s: advice on a file area\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(a[i*PGSIZE] != 'x'){
+      printf("%s: wrong file data in page %d\n", s, i);
+      exit(1);
+    }
+    a[i*PGSIZE] = 'p';
+  }
+  if(madvise((uint64)a, N*PGSIZE, MADV_NORMAL) < 0 ||
+     madvise((uint64)a, N*PGSIZE, MADV_DONTNEED) < 0){
+    printf("%s: madvise failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(a[i*PGSIZE] != 'x'){
+      printf("%s: private write survived MADV_DONTNEED\n", s);
+      exit(1);
+    }
+  }
+  munmap((uint64)a, N*PGSIZE);
+  close(fd);
+  unlink(name);
+}
+
+void
+mremaptest(char *s)
+{
+  enum { N = 4 };
+  int i, free0;
+
+  char *a = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  if(a == 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE] = i;
+
+  // nothing follows a, so it grows in place.
+  if(mremap((uint64)a, N*PGSIZE, 2*N*PGSIZE, 0) != (uint64)a){
+    printf("%s: mremap did not grow in place\n", s);
+    exit(1);
+  }
+  for(i = N; i < 2*N; i++)
+    a[i*PGSIZE] = i;
+
+  // block the addresses after a; it has to move.
+  char *b = (char*)mmap((uint64)a + 2*N*PGSIZE - MMAPBASE, PGSIZE, PROT_READ,
+                        MAP_ANONYMOUS, -1, 0);
+  if(b != a + 2*N*PGSIZE){
+    printf("%s: fixed mmap failed\n", s);
+    exit(1);
+  }
+  if(mremap((uint64)a, 2*N*PGSIZE, 4*N*PGSIZE, 0) != 0){
+    printf("%s: mremap grew over another area\n", s);
+    exit(1);
+  }
+  free0 = freemem();
+  char *c = (char*)mremap((uint64)a, 2*N*PGSIZE, 4*N*PGSIZE, MREMAP_MAYMOVE);
+  if(c == 0 || c == a){
+    printf("%s: mremap did not move\n", s);
+    exit(1);
+  }
+  // the pages moved rather than being copied.
+  if(free0 - freemem() > 2){
+    printf("%s: mremap used %d pages\n", s, free0 - freemem());
+    exit(1);
+  }
+  for(i = 0; i < 4*N; i++){
+    if(c[i*PGSIZE] != (i < 2*N ? i : 0)){
+      printf("%s: wrong data in moved page %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(mmapchild(mmaptouch, a) != -1){
+    printf("%s: old address still mapped\n", s);
+    exit(1);
+  }
+
+  // shrinking unmaps the tail.
+  if(mremap((uint64)c, 4*N*PGSIZE, PGSIZE, 0) != (uint64)c ||
+     mmapchild(mmaptouch, c + PGSIZE) != -1 || c[0] != 0){
+    printf("%s: mremap did not shrink\n", s);
+    exit(1);
+  }
+  munmap((uint64)c, PGSIZE);
+  munmap((uint64)b, PGSIZE);
+
+  // a megapage moves whole.
+  char *h = (char*)mmap(0, MEGAPGSIZE, PROT_READ|PROT_WRITE,
+                        MAP_ANONYMOUS|MAP_HUGE|MAP_POPULATE, -1, 0);
+  if(h == 0){
+    printf("%s: huge mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < MEGAPGSIZE/PGSIZE; i++)
+    h[i*PGSIZE] = i;
+  b = (char*)mmap((uint64)h + MEGAPGSIZE - MMAPBASE, PGSIZE, PROT_READ,
+                  MAP_ANONYMOUS, -1, 0);
+  free0 = freemem();
+  c = (char*)mremap((uint64)h, MEGAPGSIZE, 2*MEGAPGSIZE, MREMAP_MAYMOVE);
+  if(b == 0 || c == 0 || (uint64)c % MEGAPGSIZE != 0 || free0 - freemem() > 2){
+    printf("%s: huge mremap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < MEGAPGSIZE/PGSIZE; i++){
+    if(c[i*PGSIZE] != (char)i){
+      printf("%s: wrong data in moved megapage\n", s);
+      exit(1);
+    }
+  }
+  munmap((uint64)c, 2*MEGAPGSIZE);
+  munmap((uint64)b, PGSIZE);
+}
+
+// two processes take turns using the same virtual address for
+// different memory, remapping it now and then; neither may see
+// the other's pages through a stale TLB entry.
+void
+tlbswitch(char *s)
+{
+  enum { ROUNDS = 200 };
+  int ping[2], pong[2], pid, xstatus;
+  char c = 0;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  int me = pid == 0 ? 1 : 2;
+  int in = pid == 0 ? ping[0] : pong[0];
+  int out = pid == 0 ? pong[1] : ping[1];
+
+  for(int i = 0; i < ROUNDS; i++){
+    char *a = (char*)mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+    if(a == 0){
+      printf("%s: mmap failed\n", s);
+      exit(1);
+    }
+    a[0] = me * 40 + i % 40;
+    if(me == 2 && write(out, &c, 1) != 1)
+      exit(1);
+    if(read(in, &c, 1) != 1)
+      exit(1);
+    if(a[0] != me * 40 + i % 40){
+      printf("%s: process %d saw %d in round %d\n", s, me, a[0], i);
+      exit(1);
+    }
+    munmap((uint64)a, PGSIZE);
+    if(me == 1 && write(out, &c, 1) != 1)
+      exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+}
+
+// system calls on user buffers that no user access has
+// faulted in yet, in mmap areas and megapages.
+void
+copyuser(char *s)
+{
+  enum { N = 3 };
+  char *name = "copyuserfile";
+  char buf[64];
+  int fd, i;
+
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  for(i = 0; i < N*PGSIZE; i += sizeof(buf)){
+    memset(buf, 'a' + i / PGSIZE, sizeof(buf));
+    if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  // read() into untouched anonymous pages.
+  char *a = (char*)mmap(0, (N+1)*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  fd = open(name, O_RDONLY);
+  if(a == 0 || fd < 0 || read(fd, a + 100, N*PGSIZE) != N*PGSIZE){
+    printf("%s: read into mmap area failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < N*PGSIZE; i++){
+    if(a[100 + i] != 'a' + i / PGSIZE){
+      printf("%s: wrong byte %d read into mmap area\n", s, i);
+      exit(1);
+    }
+  }
+
+  // write() from an untouched file mapping.
+  fd = open(name, O_RDONLY);
+  char *f = (char*)mmap(0, N*PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  fd = open(name, O_RDWR);
+  if(f == 0 || fd < 0 || write(fd, f + PGSIZE, PGSIZE) != PGSIZE){
+    printf("%s: write from file mapping failed\n", s);
+    exit(1);
+  }
+  // a read-only mapping cannot take a read().
+  if(read(fd, f, 10) != -1){
+    printf("%s: read into a read-only mapping succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  munmap((uint64)f, N*PGSIZE);
+
+  // across the pages of a megapage; the file now starts
+  // with the 'b' page written above.
+  char *h = (char*)mmap(0, MEGAPGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_HUGE, -1, 0);
+  fd = open(name, O_RDONLY);
+  if(h == 0 || fd < 0 || read(fd, h + 5*PGSIZE - 7, N*PGSIZE) != N*PGSIZE ||
+     h[5*PGSIZE - 7] != 'b' || h[(N+5)*PGSIZE - 8] != 'a' + N - 1){
+    printf("%s: read into megapage failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  munmap((uint64)h, MEGAPGSIZE);
+  munmap((uint64)a, (N+1)*PGSIZE);
+  unlink(name);
+}
+
+// word j of page i in swaptest: zeros, which swap keeps
+// without data; a repeating pattern, which compresses; or
+// pseudo-random, which does not and goes to disk.
+static uint
+swapword(int i, int j)
+{
+  uint x;
+
+  switch(i % 3){
+  case 0:
+    return 0;
+  case 1:
+    return i + j % 16;
+  default:
+    x = i * (PGSIZE/4) + j + 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+  }
+}
+
+// touch more memory than is free, so that kswapd must page
+// some out, and check that it all comes back, also in a
+// child that shares the pages in swap with its parent.
+void
+swaptest(char *s)
+{
+  int n = freemem() + 2048;
+  int i, j, pid, xstatus;
+  uint *w;
+  char *a;
+
+  if(n > NSWAP)
+    n = NSWAP;
+  a = sbrklazy(n * PGSIZE);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    w = (uint*)(a + i*PGSIZE);
+    for(j = 0; j < PGSIZE/4; j++)
+      w[j] = swapword(i, j);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid > 0){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  for(i = 0; i < n; i++){
+    w = (uint*)(a + i*PGSIZE);
+    for(j = 0; j < PGSIZE/4; j++){
+      if(w[j] != swapword(i, j)){
+        printf("%s: page %d came back wrong in %s\n", s, i, pid ? "parent" : "child");
+        exit(1);
+      }
+    }
+  }
+  if(pid == 0)
+    exit(0);
+  sbrk(-n * PGSIZE);
+}
+
+// ksmd merges identical pages of an area marked MADV_MERGEABLE,
+// and each page still reads back its own contents once written.
+void
+ksmtest(char *s)
+{
+  enum { N = 64 };
+  int i, j, free0;
+  char *a;
+
+  a = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  if(a == 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  // odd pages all hold the same pattern, even ones are zeros.
+  for(i = 0; i < N; i++)
+    for(j = 0; j < PGSIZE; j++)
+      a[i*PGSIZE + j] = i % 2 ? j * 7 + 1 : 0;
+  if(madvise((uint64)a, N*PGSIZE, MADV_MERGEABLE) < 0){
+    printf("%s: MADV_MERGEABLE failed\n", s);
+    exit(1);
+  }
+  free0 = freemem();
+  for(i = 0; i < 100 && freemem() - free0 < N/2; i++)
+    pause(5);
+  if(freemem() - free0 < N/2){
+    printf("%s: pages were not merged\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE + 1] = i;
+  for(i = 0; i < N; i++){
+    for(j = 0; j < PGSIZE; j++){
+      if(a[i*PGSIZE + j] != (char)(j == 1 ? i : i % 2 ? j * 7 + 1 : 0)){
+        printf("%s: page %d wrong after merging\n", s, i);
+        exit(1);
+      }
+    }
+  }
+  if(madvise((uint64)a, N*PGSIZE, MADV_UNMERGEABLE) < 0 ||
+     madvise((uint64)a - PGSIZE, PGSIZE, MADV_MERGEABLE) != -1){
+    printf("%s: bad MADV_MERGEABLE range accepted or advice refused\n", s);
+    exit(1);
+  }
+  munmap((uint64)a, N*PGSIZE);
+}
+
+// run memory out: the oom killer should kill the process that
+// raised its oomadj first, then the one using the memory, and
+// leave the rest alone.
+void
+oomtest(char *s)
+{
+  int pid1, pid2, xstatus, fails;
+  uint i;
+  char *a;
+
+  if(oomadj(0, OOMADJMAX + 1) != -1 || oomadj(-1, 0) != -1){
+    printf("%s: bad oomadj accepted\n", s);
+    exit(1);
+  }
+
+  pid1 = fork();
+  if(pid1 < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid1 == 0){
+    oomadj(0, OOMADJMAX);
+    for(;;)
+      pause(1000);
+  }
+
+  pid2 = fork();
+  if(pid2 < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid2 == 0){
+    // a word in each page, so that they compress well and
+    // fill the swap area quickly.
+    for(i = 1, fails = 0; fails < 100; i++){
+      if((a = sbrk(PGSIZE)) == SBRK_ERROR){
+        fails++;
+        continue;
+      }
+      fails = 0;
+      *(uint*)a = i;
+    }
+    exit(0);
+  }
+
+  if(wait(&xstatus) != pid1 || xstatus != -1){
+    printf("%s: the process with the highest oomadj was not killed first\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid2 || xstatus != -1){
+    printf("%s: the memory hog was not killed\n", s);
+    exit(1);
+  }
+}
+
+// resident pages are counted as they are mapped and unmapped,
+// and a process at its RSS limit gets no more.
+void
+rsstest(char *s)
+{
+  enum { N = 32 };
+  struct memstat st0, st;
+  int i, pid, xstatus;
+  char *a;
+
+  if(memstat(0, &st0) < 0 || st0.rss <= 0 || st0.ptpages <= 0 ||
+     st0.rsslimit != RLIM_INFINITY || memstat(-1, &st) != -1){
+    printf("%s: bad memstat\n", s);
+    exit(1);
+  }
+
+  // lazily allocated heap pages count once touched.
+  a = sbrklazy((N+1)*PGSIZE);
+  a = (char*)PGROUNDUP((uint64)a);
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE] = 1;
+  memstat(0, &st);
+  if(st.rss != st0.rss + N || st.mmpages != st0.mmpages){
+    printf("%s: rss %d after touching %d heap pages, was %d\n", s, st.rss, N, st0.rss);
+    exit(1);
+  }
+  sbrk(-(N+1)*PGSIZE);
+  memstat(0, &st);
+  if(st.rss != st0.rss){
+    printf("%s: rss %d after sbrk() shrank, was %d\n", s, st.rss, st0.rss);
+    exit(1);
+  }
+
+  a = (char*)mmap(0, N*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  if(a == 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE] = 1;
+  memstat(0, &st);
+  if(st.rss != st0.rss + N || st.mmpages != st0.mmpages + N){
+    printf("%s: mmap pages not counted\n", s);
+    exit(1);
+  }
+  munmap((uint64)a, N*PGSIZE);
+  memstat(0, &st);
+  if(st.rss != st0.rss || st.mmpages != st0.mmpages){
+    printf("%s: munmap'd pages still counted\n", s);
+    exit(1);
+  }
+
+  if(setrlimit(RLIMIT_RSS + 1, 0) != -1){
+    printf("%s: unknown resource accepted\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    memstat(0, &st);
+    setrlimit(RLIMIT_RSS, (st.rss + N/2) * PGSIZE);
+    if(sbrk(N*PGSIZE) != SBRK_ERROR){
+      printf("%s: sbrk() went over the RSS limit\n", s);
+      exit(1);
+    }
+    // the fault that would go over the limit kills the child.
+    a = sbrklazy(N*PGSIZE);
+    for(i = 0; i < N; i++)
+      a[i*PGSIZE] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: process went over its RSS limit\n", s);
+    exit(1);
+  }
+}
+
+// recurse n deep with frames of over 1 KiB. Returns n.
+static int
+stackdepth(int n)
+{
+  volatile char frame[1024];
+
+  frame[0] = 1;
+  if(n == 0)
+    return 0;
+  return stackdepth(n - 1) + frame[0];
+}
+
+// the stack grows on demand far beyond the pages exec maps,
+// only the pages touched become resident, and running past
+// USTACKMAX kills the process.
+void
+stackgrow(char *s)
+{
+  enum { N = 1024 };
+  struct memstat st0, st;
+  int grew, xstatus, pid;
+
+  memstat(0, &st0);
+  if(stackdepth(N) != N){
+    printf("%s: deep recursion failed\n", s);
+    exit(1);
+  }
+  memstat(0, &st);
+  grew = st.rss - st0.rss;
+  if(grew < N*1024/PGSIZE || grew > 2*N*1024/PGSIZE){
+    printf("%s: rss grew by %d pages for %d KiB of stack\n", s, grew, N);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    stackdepth(USTACKMAX/1024);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: stack overflow was not caught\n", s);
+    exit(1);
+  }
+}
+
+// exec pages the program in on demand, sharing the page cache's
+// copies: a child's write to a data page must not show through
+// to its parent, and reading the program file into a data page
+// not touched yet must not deadlock on the file's lock.
+char execdata[2*PGSIZE] = { 1 };
+
+void
+execpaging(char *s)
+{
+  int fd, pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    execdata[0] = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || execdata[0] != 1){
+    printf("%s: child's write to data reached the parent\n", s);
+    exit(1);
+  }
+
+  fd = open("usertests", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open usertests failed\n", s);
+    exit(1);
+  }
+  if(read(fd, execdata + PGSIZE, PGSIZE) != PGSIZE ||
+     execdata[PGSIZE] != 0x7f || execdata[PGSIZE+1] != 'E'){
+    printf("%s: reading usertests into its own data failed\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+// spawn() starts a program with just the descriptors it is
+// given: cat sees EOF once the parent closes the pipe's write
+// end, which it would not if it had a copy of it too.
+void
+spawntest(char *s)
+{
+  char *catargv[] = { "cat", 0 };
+  char *echoargv[] = { "echo", "OK", 0 };
+  int p[2], fds[3], fd, pid, xstatus;
+  char buf[3];
+
+  if(spawn("nonexistent", echoargv, 0, 0) != -1){
+    printf("%s: spawn of a missing file succeeded\n", s);
+    exit(1);
+  }
+  fds[0] = 0; fds[1] = NOFILE - 1; fds[2] = 2;
+  if(spawn("echo", echoargv, fds, 3) != -1){
+    printf("%s: spawn with a closed descriptor succeeded\n", s);
+    exit(1);
+  }
+
+  unlink("spawn-ok");
+  if(pipe(p) < 0 || (fd = open("spawn-ok", O_CREATE|O_WRONLY)) < 0){
+    printf("%s: pipe or create failed\n", s);
+    exit(1);
+  }
+  fds[0] = p[0]; fds[1] = fd; fds[2] = 2;
+  pid = spawn("cat", catargv, fds, 3);
+  close(p[0]);
+  close(fd);
+  if(pid < 0){
+    printf("%s: spawn cat failed\n", s);
+    exit(1);
+  }
+  write(p[1], "OK", 2);
+  close(p[1]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: cat did not exit\n", s);
+    exit(1);
+  }
+
+  fd = open("spawn-ok", O_RDONLY);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != 2 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("spawn-ok");
+
+  // echoargv, on this stack, reaches the child.
+  if((fd = open("spawn-ok", O_CREATE|O_WRONLY)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  fds[0] = 0; fds[1] = fd; fds[2] = 2;
+  pid = spawn("echo", echoargv, fds, 3);
+  close(fd);
+  if(pid < 0 || wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  fd = open("spawn-ok", O_RDONLY);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != 3 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: echo got the wrong arguments\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("spawn-ok");
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2765,6 +4380,32 @@ struct test {
   {lazy_alloc, "lazy_alloc"},
   {lazy_unmap, "lazy_unmap"},
   {lazy_copy, "lazy_copy"},
+  {zeroalloc, "zeroalloc"},
+  {cowfork, "cowfork"},
+  {zeropage, "zeropage"},
+  {lazyfork, "lazyfork"},
+  {mmapheap, "mmapheap"},
+  {hugemmap, "hugemmap"},
+  {mmapcache, "mmapcache"},
+  {mmapshared, "mmapshared"},
+  {mmapprivate, "mmapprivate"},
+  {mmapscan, "mmapscan"},
+  {mmapreuse, "mmapreuse"},
+  {mmapfork, "mmapfork"},
+  {mmappartial, "mmappartial"},
+  {mmapread, "mmapread"},
+  {mprotecttest, "mprotect"},
+  {madvisetest, "madvise"},
+  {mremaptest, "mremap"},
+  {tlbswitch, "tlbswitch"},
+  {copyuser, "copyuser"},
+  {swaptest, "swap"},
+  {ksmtest, "ksm"},
+  {oomtest, "oom"},
+  {rsstest, "rss"},
+  {stackgrow, "stackgrow"},
+  {execpaging, "execpaging"},
+  {spawntest, "spawn"},
   { 0, 0},
 };
 
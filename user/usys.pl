@@ -50,4 +50,13 @@ entry("waitpid");
 entry("mmap");
 entry("munmap");
 entry("freemem");
+entry("membench");
+entry("msync");
+entry("mprotect");
+entry("madvise");
+entry("mremap");
+entry("oomadj");
+entry("memstat");
+entry("setrlimit");
+entry("spawn");
 